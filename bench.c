@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+
+Benchmarks each stage of turning an image into terminal output.
+
+python3 bear_make.py make_bench -r
+./ti_bench > bench_output.txt
+./ti_bench -r 10 -t 4 test/wizards.jpg
+
+Prints one json object per line for every image, terminal size and stage:
+
+{"image":"test/wizards.jpg","cols":80,"rows":24,"stage":"scale","ns":81234,"pixels":...,"cells":...,"ns_per_pixel":...,"ns_per_cell":...,"allocations":0,"output_bytes":0,"saved_bytes":0}
+
+Stages are decode_full (stbi_load), decode (load_image, what ti does), scale, kmeans, glyph, convert (all of it, like ti does), first_row (until
+the first row is ready when converting a row at a time, see convert_image_rows) and emit.
+ns is the fastest of the runs, pixels are the decoded pixels for the decode stages and the
+scaled pixels for everything else. allocations counts every malloc, calloc, realloc and strdup
+made during one run of the stage. output_bytes and saved_bytes are the size of the
+ansii output and how much skipping repeated colors saved.
+
+*/
+
+
+// count allocations made by everything included below
+static long allocations = 0;
+
+static void* counted_malloc(size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return malloc(size);
+}
+
+static void* counted_calloc(size_t count, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return calloc(count, size);
+}
+
+static void* counted_realloc(void* pointer, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return realloc(pointer, size);
+}
+
+static char* counted_strdup(const char* string) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return strdup(string);
+}
+
+#define malloc(size) counted_malloc(size)
+#define calloc(count, size) counted_calloc(count, size)
+#define realloc(pointer, size) counted_realloc(pointer, size)
+#define strdup(string) counted_strdup(string)
+
+#include "dependencies/TerminalImages.h"
+
+
+typedef struct {
+    double ns;
+    long allocations;
+} Measurement;
+
+static double now_ns() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static long allocation_count() {
+    return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+// keeps the fastest run and the allocations from it
+static void record(Measurement* measurement, double start_ns, long start_allocations) {
+    double ns = now_ns() - start_ns;
+    if (measurement->ns == 0 || ns < measurement->ns) {
+        measurement->ns = ns;
+        measurement->allocations = allocation_count() - start_allocations;
+    }
+}
+
+// remembers when the first row of cells came out of convert_image_rows
+typedef struct {
+    double ns;
+    long allocations;
+} FirstRow;
+
+static void on_row(void* arg, int row, TImagePackedCell* cells, int display_width) {
+    (void)cells;
+    (void)display_width;
+    FirstRow* first_row = arg;
+    if (row == 0) {
+        first_row->ns = now_ns();
+        first_row->allocations = allocation_count();
+    }
+}
+
+// prints a string as a json string, with quotes, backslashes and control characters escaped
+static void print_json_string(const char* string) {
+    putchar('"');
+    for (const unsigned char* c = (const unsigned char*)string; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            printf("\\%c", *c);
+        }
+        else if (*c < 0x20) {
+            printf("\\u%04x", *c);
+        }
+        else {
+            putchar(*c);
+        }
+    }
+    putchar('"');
+}
+
+static void print_measurement(
+    const char* image,
+    int cols,
+    int rows,
+    const char* stage,
+    Measurement measurement,
+    long pixels,
+    long cells,
+    size_t output_bytes,
+    size_t saved_bytes
+) {
+    printf("{\"image\":");
+    print_json_string(image);
+    printf(
+        ",\"cols\":%d,\"rows\":%d,\"stage\":\"%s\",\"ns\":%.0f,\"pixels\":%ld,\"cells\":%ld,"
+        "\"ns_per_pixel\":%.3f,\"ns_per_cell\":%.3f,\"allocations\":%ld,\"output_bytes\":%zu,\"saved_bytes\":%zu}\n",
+        cols,
+        rows,
+        stage,
+        measurement.ns,
+        pixels,
+        cells,
+        pixels > 0? measurement.ns / pixels : 0,
+        cells > 0? measurement.ns / cells : 0,
+        measurement.allocations,
+        output_bytes,
+        saved_bytes
+    );
+    fflush(stdout);
+}
+
+
+static void bench_image(char* path, int cols, int rows, int runs, int thread_count) {
+    TImageConverter* converter = new_image_converter();
+    converter->thread_count = thread_count;
+    TImageFrameBuffer* frame = new_frame_buffer();
+
+    // DECODE at full size
+    Measurement decode_full = {0, 0};
+    int image_width, image_height, channels;
+    uint8_t* image = NULL;
+    for (int run = 0; run < runs; ++run) {
+        free(image);
+        double start = now_ns();
+        long start_allocations = allocation_count();
+        image = stbi_load(path, &image_width, &image_height, &channels, 0);
+        record(&decode_full, start, start_allocations);
+        if (image == NULL) {
+            fprintf(stderr, "Failed to load image %s: %s\n", path, stbi_failure_reason());
+            exit(-1);
+        }
+    }
+    print_measurement(path, cols, rows, "decode_full", decode_full, (long)image_width * image_height, 0, 0, 0);
+
+    // DECODE the way ti does, which can be smaller for jpegs
+    Measurement decode = {0, 0};
+    for (int run = 0; run < runs; ++run) {
+        free(image);
+        double start = now_ns();
+        long start_allocations = allocation_count();
+        image = load_image(converter, path, cols, rows, &image_width, &image_height, &channels);
+        record(&decode, start, start_allocations);
+    }
+    print_measurement(path, cols, rows, "decode", decode, (long)image_width * image_height, 0, 0, 0);
+
+    // SCALE
+    int new_width, new_height;
+    scaled_image_size(image_width, image_height, cols, rows, &new_width, &new_height);
+    long new_pixels = (long)new_width * new_height;
+    uint8_t* new_image = malloc(new_pixels * 4);
+    Measurement scale = {0, 0};
+    for (int run = 0; run < runs; ++run) {
+        double start = now_ns();
+        long start_allocations = allocation_count();
+        scale_image_bilinear(image, image_width, image_height, channels, new_image, new_width, new_height);
+        record(&scale, start, start_allocations);
+    }
+    print_measurement(path, cols, rows, "scale", scale, new_pixels, 0, 0, 0);
+
+    // KMEANS
+    int width_cells = new_width / CURSOR_WIDTH;
+    int height_cells = new_height / CURSOR_HEIGHT;
+    long cells = (long)width_cells * height_cells;
+    int* averages = malloc(cells * 8 * sizeof(int));
+    Measurement kmeans = {0, 0};
+    for (int run = 0; run < runs; ++run) {
+        double start = now_ns();
+        long start_allocations = allocation_count();
+        for (int c_y = 0; c_y < height_cells; ++c_y) {
+            for (int c_x = 0; c_x < width_cells; ++c_x) {
+                int* avg = &averages[(c_x + c_y * width_cells) * 8];
+                kmeans_for_colors(
+                    new_image,
+                    c_x,
+                    c_y,
+                    width_cells,
+                    CURSOR_WIDTH,
+                    CURSOR_HEIGHT,
+                    converter->kmeans_iterations,
+                    &avg[0],
+                    &avg[1],
+                    &avg[2],
+                    &avg[3],
+                    &avg[4],
+                    &avg[5],
+                    &avg[6],
+                    &avg[7]
+                );
+            }
+        }
+        record(&kmeans, start, start_allocations);
+    }
+    print_measurement(path, cols, rows, "kmeans", kmeans, new_pixels, cells, 0, 0);
+
+    // GLYPH matching, including splitting the pixels by color
+    Measurement glyph = {0, 0};
+    int glyph_sum = 0;
+    for (int run = 0; run < runs; ++run) {
+        double start = now_ns();
+        long start_allocations = allocation_count();
+        for (int c_y = 0; c_y < height_cells; ++c_y) {
+            for (int c_x = 0; c_x < width_cells; ++c_x) {
+                int* avg = &averages[(c_x + c_y * width_cells) * 8];
+                uint64_t first_variation[2];
+                uint64_t second_variation[2];
+                cell_variations(new_image, width_cells, c_x, c_y, &avg[0], &avg[4], first_variation, second_variation);
+                int is_first_best;
+                glyph_sum += converter->match_glyph(first_variation, second_variation, &is_first_best);
+            }
+        }
+        record(&glyph, start, start_allocations);
+    }
+    if (glyph_sum == -1) printf("\n"); // keeps the matching from being optimized away
+    print_measurement(path, cols, rows, "glyph", glyph, new_pixels, cells, 0, 0);
+
+    // CONVERT everything (decode to packed cells) the way ti does
+    Measurement convert = {0, 0};
+    TImagePackedCell* packed = NULL;
+    for (int run = 0; run < runs; ++run) {
+        double start = now_ns();
+        long start_allocations = allocation_count();
+        packed = convert_image_to_packed_cells(converter, path, cols, rows, NULL);
+        record(&convert, start, start_allocations);
+    }
+    print_measurement(path, cols, rows, "convert", convert, new_pixels, (long)cols * rows, 0, 0);
+
+    // FIRST ROW of cells when converting a row at a time
+    Measurement first_row = {0, 0};
+    for (int run = 0; run < runs; ++run) {
+        FirstRow first = {0, 0};
+        double start = now_ns();
+        long start_allocations = allocation_count();
+        convert_image_rows(converter, path, cols, rows, on_row, &first);
+        double ns = first.ns - start;
+        if (first_row.ns == 0 || ns < first_row.ns) {
+            first_row.ns = ns;
+            first_row.allocations = first.allocations - start_allocations;
+        }
+    }
+    print_measurement(path, cols, rows, "first_row", first_row, new_pixels, cols, 0, 0);
+
+    // EMIT the ansii output
+    Measurement emit = {0, 0};
+    for (int run = 0; run < runs; ++run) {
+        double start = now_ns();
+        long start_allocations = allocation_count();
+        frame_clear(frame);
+        frame_append_cells(frame, packed, cols, rows);
+        record(&emit, start, start_allocations);
+    }
+    print_measurement(path, cols, rows, "emit", emit, 0, (long)cols * rows, frame->len, frame->unoptimized_len - frame->len);
+
+    free(averages);
+    free(new_image);
+    free(image);
+    free_frame_buffer(frame);
+    free_image_converter(converter);
+}
+
+
+int main(int argc, char **argv) {
+    int runs = 3;
+    int thread_count = 1;
+    char* images[64];
+    int image_count = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+        }
+        else if (image_count < 64) {
+            images[image_count++] = argv[i];
+        }
+    }
+    if (runs < 1) runs = 1;
+    if (image_count == 0) {
+        images[image_count++] = "test/wizards.jpg";
+        images[image_count++] = "test/red_castle.jpg";
+        images[image_count++] = "test/skull_knight.png";
+        images[image_count++] = "test/test.png";
+    }
+
+    int sizes[][2] = {
+        {80, 24},
+        {200, 60},
+        {300, 80},
+    };
+    for (int i = 0; i < image_count; ++i) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            bench_image(images[i], sizes[s][0], sizes[s][1], runs, thread_count);
+        }
+    }
+
+    return 0;
+}
@@ -1528,6 +1528,14 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
 
+// same as above, but jpegs are decoded straight at 1/2, 1/4 or 1/8 of their size: the smallest that
+// still fills a fit_w x fit_h box when scaled (without distortion) to fit in it, so at least fit_w wide
+// or fit_h tall. *x and *y are the reduced size. other formats are loaded at full size
+STBIDEF stbi_uc *stbi_load_from_memory_to_fit(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int fit_w, int fit_h);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_to_fit      (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, int fit_w, int fit_h);
+#endif
+
 #ifdef STBI_WINDOWS_UTF8
 STBIDEF int stbi_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
 #endif
@@ -1912,6 +1920,8 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   int fit_w, fit_h; // see stbi_load_to_fit, 0 to decode at full size
 } stbi__context;
 
 
@@ -1925,6 +1935,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->callback_already_read = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
+   s->fit_w = s->fit_h = 0;
 }
 
 // initialize a callback-based context
@@ -1938,6 +1949,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->img_buffer = s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
+   s->fit_w = s->fit_h = 0;
 }
 
 #ifndef STBI_NO_STDIO
@@ -2468,6 +2480,20 @@ STBIDEF stbi_uc *stbi_load(char const *filename, int *x, int *y, int *comp, int
    return result;
 }
 
+STBIDEF stbi_uc *stbi_load_to_fit(char const *filename, int *x, int *y, int *comp, int req_comp, int fit_w, int fit_h)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   unsigned char *result;
+   stbi__context s;
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   s.fit_w = fit_w;
+   s.fit_h = fit_h;
+   result = stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+
 STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
    unsigned char *result;
@@ -2528,6 +2554,15 @@ STBIDEF stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, i
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF stbi_uc *stbi_load_from_memory_to_fit(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int fit_w, int fit_h)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   s.fit_w = fit_w;
+   s.fit_h = fit_h;
+   return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+}
+
 STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
 {
    stbi__context s;
@@ -3089,6 +3124,8 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+   int scale_shift; // the components are decoded 1 << scale_shift times smaller
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
@@ -3618,6 +3655,67 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced idct for decoding at 1/2, 1/4 or 1/8 scale (see stbi_load_to_fit). makes size x size
+// pixels (size is 4, 2 or 1) from the lowest size x size frequencies, which is the full idct
+// with the basis functions sampled at the centers of the (8/size) x (8/size) squares each
+// output pixel stands for
+static void stbi__idct_block_reduced(stbi_uc *out, int out_stride, short data[64], int size)
+{
+   int i, tmp[16];
+   const int a = stbi__f2f(0.35355339f); // cos(pi/4) / 2
+   const int b = stbi__f2f(0.46193977f); // cos(pi/8) / 2
+   const int c = stbi__f2f(0.19134172f); // cos(3*pi/8) / 2
+
+   if (size == 1) {
+      // just the dc term, which is 8 times the average
+      out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+      return;
+   }
+
+   if (size == 2) {
+      // both basis functions are +-cos(pi/4) / 2 at the sample points, so each pixel is a sum over 8
+      int sum0 = data[0] + data[8], dif0 = data[0] - data[8];
+      int sum1 = data[1] + data[9], dif1 = data[1] - data[9];
+      out[0]            = stbi__clamp(((sum0 + sum1 + 4) >> 3) + 128);
+      out[1]            = stbi__clamp(((sum0 - sum1 + 4) >> 3) + 128);
+      out[out_stride]   = stbi__clamp(((dif0 + dif1 + 4) >> 3) + 128);
+      out[out_stride+1] = stbi__clamp(((dif0 - dif1 + 4) >> 3) + 128);
+      return;
+   }
+
+   // 4 point idct as even and odd halves: rows first, keeping 1 fractional bit
+   for (i=0; i < 4; ++i) {
+      short *d = data + i*8;
+      int *t = tmp + i*4;
+      int e0, e1, o0, o1;
+      if (d[1] == 0 && d[2] == 0 && d[3] == 0) {
+         t[0] = t[1] = t[2] = t[3] = (a * d[0] + (1 << 10)) >> 11;
+         continue;
+      }
+      e0 = a * (d[0] + d[2]);
+      e1 = a * (d[0] - d[2]);
+      o0 = b * d[1] + c * d[3];
+      o1 = c * d[1] - b * d[3];
+      t[0] = (e0 + o0 + (1 << 10)) >> 11;
+      t[1] = (e1 + o1 + (1 << 10)) >> 11;
+      t[2] = (e1 - o1 + (1 << 10)) >> 11;
+      t[3] = (e0 - o0 + (1 << 10)) >> 11;
+   }
+   // then columns, which leaves 13 fractional bits to round off
+   for (i=0; i < 4; ++i) {
+      int *t = tmp + i;
+      int e0 = a * (t[0] + t[8]);
+      int e1 = a * (t[0] - t[8]);
+      int o0 = b * t[4] + c * t[12];
+      int o1 = c * t[4] - b * t[12];
+      const int round = (1 << 12) + (128 << 13);
+      out[i]              = stbi__clamp((e0 + o0 + round) >> 13);
+      out[i+out_stride]   = stbi__clamp((e1 + o1 + round) >> 13);
+      out[i+out_stride*2] = stbi__clamp((e1 - o1 + round) >> 13);
+      out[i+out_stride*3] = stbi__clamp((e0 - o0 + round) >> 13);
+   }
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -4041,6 +4139,18 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// idct the block whose top left corner is at x, y of component n, at the scale it's decoded at
+static void stbi__jpeg_idct(stbi__jpeg *z, int n, int x, int y, short data[64])
+{
+   int shift = z->scale_shift;
+   int stride = z->img_comp[n].w2 >> shift;
+   stbi_uc *out = z->img_comp[n].data + stride*(y >> shift) + (x >> shift);
+   if (shift == 0)
+      z->idct_block_kernel(out, stride, data);
+   else
+      stbi__idct_block_reduced(out, stride, data, 8 >> shift);
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
@@ -4059,7 +4169,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, n, i*8, j*8, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -4087,7 +4197,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                         int y2 = (j*z->img_comp[n].v + y)*8;
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        stbi__jpeg_idct(z, n, x2, y2, data);
                      }
                   }
                }
@@ -4184,7 +4294,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, n, i*8, j*8, data);
             }
          }
       }
@@ -4404,6 +4514,13 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       if (v_max % z->img_comp[i].v != 0) return stbi__err("bad V","Corrupt JPEG");
    }
 
+   // decode smaller if the caller asked for it and the image is big enough
+   z->scale_shift = 0;
+   if (s->fit_w > 0 && s->fit_h > 0) {
+      while (z->scale_shift < 3 && ((int) (s->img_x >> (z->scale_shift+1)) >= s->fit_w || (int) (s->img_y >> (z->scale_shift+1)) >= s->fit_h))
+         ++z->scale_shift;
+   }
+
    // compute interleaved mcu info
    z->img_h_max = h_max;
    z->img_v_max = v_max;
@@ -4429,7 +4546,7 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
-      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
+      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2 >> z->scale_shift, z->img_comp[i].h2 >> z->scale_shift, 15);
       if (z->img_comp[i].raw_data == NULL)
          return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
       // align blocks for idct using mmx/sse
@@ -4503,6 +4620,16 @@ static stbi_uc stbi__skip_jpeg_junk_at_end(stbi__jpeg *j)
    return STBI__MARKER_none;
 }
 
+// skips a scan's entropy coded data without decoding it, up to the next marker that isn't a restart
+static void stbi__jpeg_skip_scan(stbi__jpeg *j)
+{
+   stbi_uc m;
+   do {
+      m = stbi__skip_jpeg_junk_at_end(j);
+   } while (STBI__RESTART(m));
+   j->marker = m;
+}
+
 // decode image to YCbCr format
 static int stbi__decode_jpeg_image(stbi__jpeg *j)
 {
@@ -4517,7 +4644,12 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
    while (!stbi__EOI(m)) {
       if (stbi__SOS(m)) {
          if (!stbi__process_scan_header(j)) return 0;
-         if (!stbi__parse_entropy_coded_data(j)) return 0;
+         // at 1/8 size only the dc coefficients are used, so the ac scans don't need decoding.
+         // (at other sizes a refinement scan needs every earlier scan of its band decoded, even
+         // for the frequencies that aren't used)
+         if (j->progressive && j->scale_shift == 3 && j->spec_start != 0)
+            stbi__jpeg_skip_scan(j);
+         else if (!stbi__parse_entropy_coded_data(j)) return 0;
          if (j->marker == STBI__MARKER_none ) {
          j->marker = stbi__skip_jpeg_junk_at_end(j);
             // if we reach eof without hitting a marker, stbi__get_marker() below will fail and we'll eventually return 0
@@ -4968,6 +5100,19 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+   // the components were decoded smaller, so from here on the image is that much smaller too
+   if (z->scale_shift) {
+      int shift = z->scale_shift, round = (1 << shift) - 1;
+      for (n=0; n < z->s->img_n; ++n) {
+         z->img_comp[n].x = (z->img_comp[n].x + round) >> shift;
+         z->img_comp[n].y = (z->img_comp[n].y + round) >> shift;
+         z->img_comp[n].w2 >>= shift;
+         z->img_comp[n].h2 >>= shift;
+      }
+      z->s->img_x = (z->s->img_x + round) >> shift;
+      z->s->img_y = (z->s->img_y + round) >> shift;
+   }
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
@@ -10816,8 +10961,29 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define TIMAGE_X86_DISPATCH
+#include <immintrin.h>
+#endif
 
 
 
@@ -10834,374 +11000,350 @@ char* RESET = "\033[0m";
 char* RED = "\033[252;3;3m";
 char* YELLOW = "\033[252;186;3m";
 
-int KMEANS_ITERATIONS = 3; // trades speed for color accuracy
+int KMEANS_ITERATIONS = 3; // trades speed for color accuracy (default for new converters)
 
 
-Map* make_character_map() {
+/*
+    The characters cells are drawn with, as a flat table.
 
-    // ▙▂▝╫┃╯╳▖▚▞ ╲▗▀▛▟█┳╭╱▒▘▜╋░
+    GLYPH_MASKS[i] holds the pixels GLYPH_CHARACTERS[i] covers: 8 bits per row from
+    the top left, split over two uint64_t's (top half first). The order is the one
+    the old character map happened to iterate in, so ties between characters still
+    go the same way.
 
-    Map* character_to_pixels = new_map();
-    uint64_t* copy;
-    uint64_t full[2] = {
-        0b1111111111111111111111111111111111111111111111111111111111111111ULL,
-        0b1111111111111111111111111111111111111111111111111111111111111111ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, full, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "█", copy, sizeof(full));
+    // ▙▂▝╫┃╯╳▖▚▞ ╲▗▀▛▟█┳╭╱▒▘▜╋░
+*/
+#define GLYPH_COUNT 15
+#define GLYPH_TABLE_SIZE 16 // GLYPH_COUNT rounded up to pairs, the avx2 matcher reads two masks at a time
 
-    uint64_t empty[2] = {
-        0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-        0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, empty, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, " ", copy, sizeof(empty));
-
-   //  uint64_t dots[2] = {
-   //      0b1000100000000000001000100000000010001000000000000010001000000000ULL,
-   //      0b1000100000000000001000100000000010001000000000000010001000000000ULL,
-   //  };
-   //  copy = malloc(2 * sizeof(uint64_t));
-   //  memcpy(copy, dots, 2 * sizeof(uint64_t));
-   //  m_put(character_to_pixels, "░", copy, sizeof(dots));
-
-    uint64_t l[2] = {
+const uint64_t GLYPH_MASKS[GLYPH_TABLE_SIZE][2] = {
+    { // ▙
         0b1111000011110000111100001111000011110000111100001111000011110000ULL,
         0b1111111111111111111111111111111111111111111111111111111111111111ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, l, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "▙", copy, sizeof(l));
-
-    uint64_t slab[2] = {
+    },
+    { // ▂
         0b0000000000000000000000000000000000000000000000000000000000000000ULL,
         0b0000000000000000000000001111111111111111111111111111111111111111ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, slab, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "▂", copy, sizeof(slab));
-
-   //  uint64_t cross[2] = {
-   //      0b0011110000111100001111000011110000111100001111001111111111111111ULL,
-   //      0b1111111111111111001111000011110000111100001111000011110000111100ULL,
-   //  };
-   //  copy = malloc(2 * sizeof(uint64_t));
-   //  memcpy(copy, cross, 2 * sizeof(uint64_t));
-   //  m_put(character_to_pixels, "╋", copy, sizeof(cross));
-
-   //  uint64_t pole[2] = {
-   //      0b0011110000111100001111000011110000111100001111000011110000111100ULL,
-   //      0b0011110000111100001111000011110000111100001111000011110000111100ULL,
-   //  };
-   //  copy = malloc(2 * sizeof(uint64_t));
-   //  memcpy(copy, pole, 2 * sizeof(uint64_t));
-   //  m_put(character_to_pixels, "┃", copy, sizeof(pole));
-
-   //  uint64_t r[2] = {
-   //      0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-   //      0b0000011100001100000110000001000000010000000100000001000000010000ULL,
-   //  };
-   //  copy = malloc(2 * sizeof(uint64_t));
-   //  memcpy(copy, full, 2 * sizeof(uint64_t));
-   //  m_put(character_to_pixels, "╭", copy, sizeof(r));
-
-   //  uint64_t x_sym[2] = {
-   //      0b1000000110000001110000110100001001100110001001000010010000011000ULL,
-   //      0b0001100000100100001001000110011001000010110000111000000110000001ULL,
-   //  };
-   //  copy = malloc(2 * sizeof(uint64_t));
-   //  memcpy(copy, x_sym, 2 * sizeof(uint64_t));
-   //  m_put(character_to_pixels, "╳", copy, sizeof(x_sym));
-
-   //  uint64_t j[2] = {
-   //      0b0001000000010000000100000001000000010000001100000110000011000000ULL,
-   //      0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-   //  };
-   //  copy = malloc(2 * sizeof(uint64_t));
-   //  memcpy(copy, j, 2 * sizeof(uint64_t));
-   //  m_put(character_to_pixels, "╯", copy, sizeof(j));
-
-   //  uint64_t crossed_poles[2] = {
-   //      0b0010010000100100001001000010010000100100001001000010010011111111ULL,
-   //      0b0010010000100100001001000010010000100100001001000010010000100100ULL,
-   //  };
-   //  copy = malloc(2 * sizeof(uint64_t));
-   //  memcpy(copy, crossed_poles, 2 * sizeof(uint64_t));
-   //  m_put(character_to_pixels, "╫", copy, sizeof(crossed_poles));
-
-   //  uint64_t t[2] = {
-   //      0b0000000000000000000000000000000000000000000000001111111111111111ULL,
-   //      0b1111111100111100001111000011110000111100001111000011110000111100ULL,
-   //  };
-   //  copy = malloc(2 * sizeof(uint64_t));
-   //  memcpy(copy, t, 2 * sizeof(uint64_t));
-   //  m_put(character_to_pixels, "┳", copy, sizeof(t));
-
-    uint64_t p[2] = {
-        0b1111111111111111111111111111111111111111111111111111111111111111ULL,
-        0b1111000011110000111100001111000011110000111100001111000011110000ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, p, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "▛", copy, sizeof(p));
-
-    uint64_t grid[2] = {
+    },
+    { // ▝
+        0b0000111100001111000011110000111100001111000011110000111100001111ULL,
+        0b0000000000000000000000000000000000000000000000000000000000000000ULL,
+    },
+    { // ▒
         0b1010101000000000010101010000000010101010000000000101010100000000ULL,
         0b1010101000000000010101010000000010101010000000000101010100000000ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, grid, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "▒", copy, sizeof(grid));
-
-    uint64_t right_corner[2] = {
+    },
+    { // ▖
+        0b0000000000000000000000000000000000000000000000000000000000000000ULL,
+        0b1111000011110000111100001111000011110000111100001111000011110000ULL,
+    },
+    { // ▚
+        0b1111000011110000111100001111000011110000111100001111000011110000ULL,
         0b0000111100001111000011110000111100001111000011110000111100001111ULL,
+    },
+    { // ▞
+        0b0000111100001111000011110000111100001111000011110000111100001111ULL,
+        0b1111000011110000111100001111000011110000111100001111000011110000ULL,
+    },
+    { // empty
         0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, right_corner, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "▝", copy, sizeof(right_corner));
-
-    uint64_t top_slab[2] = {
+        0b0000000000000000000000000000000000000000000000000000000000000000ULL,
+    },
+    { // ▗
+        0b0000000000000000000000000000000000000000000000000000000000000000ULL,
+        0b0000111100001111000011110000111100001111000011110000111100001111ULL,
+    },
+    { // ▀
         0b1111111111111111111111111111111111111111111111111111111111111111ULL,
         0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, top_slab, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "▀", copy, sizeof(top_slab));
-
-    uint64_t corner_squares[2] = {
+    },
+    { // ▛
+        0b1111111111111111111111111111111111111111111111111111111111111111ULL,
         0b1111000011110000111100001111000011110000111100001111000011110000ULL,
+    },
+    { // ▟
         0b0000111100001111000011110000111100001111000011110000111100001111ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, corner_squares, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "▚", copy, sizeof(corner_squares));
-
-    uint64_t corner_squares_2[2] = {
-        0b0000111100001111000011110000111100001111000011110000111100001111ULL,
+        0b1111111111111111111111111111111111111111111111111111111111111111ULL,
+    },
+    { // █
+        0b1111111111111111111111111111111111111111111111111111111111111111ULL,
+        0b1111111111111111111111111111111111111111111111111111111111111111ULL,
+    },
+    { // ▘
         0b1111000011110000111100001111000011110000111100001111000011110000ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, corner_squares_2, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "▞", copy, sizeof(corner_squares_2));
-
-   //  uint64_t forward_slash[2] = {
-   //      0b0000000100000011000001100000010000001100000010000001100000010000ULL,
-   //      0b0001000000110000001000000110000001100000110000001000000010000000ULL,
-   //  };
-   //  copy = malloc(2 * sizeof(uint64_t));
-   //  memcpy(copy, forward_slash, 2 * sizeof(uint64_t));
-   //  m_put(character_to_pixels, "╱", copy, sizeof(forward_slash));
-
-   //  uint64_t back_slash[2] = {
-   //      0b1000000010000000110000000100000001100000001000000010000000110000ULL,
-   //      0b0001000000011000000010000000110000001100000001100000001000000011ULL,
-   //  };
-   //  copy = malloc(2 * sizeof(uint64_t));
-   //  memcpy(copy, back_slash, 2 * sizeof(uint64_t));
-   //  m_put(character_to_pixels, "╲", copy, sizeof(back_slash));
-
-    uint64_t top_right_half[2] = {
+        0b0000000000000000000000000000000000000000000000000000000000000000ULL,
+    },
+    { // ▜
         0b1111111111111111111111111111111111111111111111111111111111111111ULL,
         0b0000111100001111000011110000111100001111000011110000111100001111ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, top_right_half, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "▜", copy, sizeof(top_right_half));
+    },
+};
 
-    uint64_t bottom_right_half[2] = {
-        0b0000111100001111000011110000111100001111000011110000111100001111ULL,
-        0b1111111111111111111111111111111111111111111111111111111111111111ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, bottom_right_half, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "▟", copy, sizeof(bottom_right_half));
+const char* GLYPH_CHARACTERS[GLYPH_COUNT] = {
+    "▙", "▂", "▝", "▒", "▖", "▚", "▞", " ", "▗", "▀", "▛", "▟", "█", "▘", "▜",
+};
 
-    uint64_t bottom_left[2] = {
+/*
+    Other characters that have been tried out, in the same format:
+
+    ░ dots
+        0b1000100000000000001000100000000010001000000000000010001000000000ULL,
+        0b1000100000000000001000100000000010001000000000000010001000000000ULL,
+
+    ╋ cross
+        0b0011110000111100001111000011110000111100001111001111111111111111ULL,
+        0b1111111111111111001111000011110000111100001111000011110000111100ULL,
+
+    ┃ pole
+        0b0011110000111100001111000011110000111100001111000011110000111100ULL,
+        0b0011110000111100001111000011110000111100001111000011110000111100ULL,
+
+    ╭ r
         0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-        0b1111000011110000111100001111000011110000111100001111000011110000ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, bottom_left, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "▖", copy, sizeof(bottom_left));
+        0b0000011100001100000110000001000000010000000100000001000000010000ULL,
 
-    uint64_t bottom_right[2] = {
+    ╳ x_sym
+        0b1000000110000001110000110100001001100110001001000010010000011000ULL,
+        0b0001100000100100001001000110011001000010110000111000000110000001ULL,
+
+    ╯ j
+        0b0001000000010000000100000001000000010000001100000110000011000000ULL,
         0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-        0b0000111100001111000011110000111100001111000011110000111100001111ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, bottom_right, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "▗", copy, sizeof(bottom_right));
 
-    uint64_t top_left[2] = {
-        0b1111000011110000111100001111000011110000111100001111000011110000ULL,
+    ╫ crossed_poles
+        0b0010010000100100001001000010010000100100001001000010010011111111ULL,
+        0b0010010000100100001001000010010000100100001001000010010000100100ULL,
+
+    ┳ t
+        0b0000000000000000000000000000000000000000000000001111111111111111ULL,
+        0b1111111100111100001111000011110000111100001111000011110000111100ULL,
+
+    ╱ forward_slash
+        0b0000000100000011000001100000010000001100000010000001100000010000ULL,
+        0b0001000000110000001000000110000001100000110000001000000010000000ULL,
+
+    ╲ back_slash
+        0b1000000010000000110000000100000001100000001000000010000000110000ULL,
+        0b0001000000011000000010000000110000001100000001100000001000000011ULL,
+
+    □ square
+        0b0000000000000000000000000000000000000000111111111000000110000001ULL,
+        0b1000000110000001100000011000000111111111000000000000000000000000ULL,
+
+    ╹ top_tick
+        0b0001100000011000000110000001100000011000000110000001100000011000ULL,
         0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-    };
-    copy = malloc(2 * sizeof(uint64_t));
-    memcpy(copy, top_left, 2 * sizeof(uint64_t));
-    m_put(character_to_pixels, "▘", copy, sizeof(top_left));
-
-
-
-    // uint64_t square[2] = {
-    //     0b0000000000000000000000000000000000000000111111111000000110000001ULL,
-    //     0b1000000110000001100000011000000111111111000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "□", square, sizeof(square));
-
-    // uint64_t top_tick[2] = {
-    //     0b0001100000011000000110000001100000011000000110000001100000011000ULL,
-    //     0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "╹", top_tick, sizeof(top_tick));
-
-    // uint64_t right_stub[2] = {
-    //     0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-    //     0b0000111100001111000000000000000000000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "╺", right_stub, sizeof(right_stub));
-
-    // uint64_t left_stub[2] = {
-    //     0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-    //     0b1111000000000000000000000000000000000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "╴", left_stub, sizeof(left_stub));
-
-    // uint64_t note[2] = {
-    //     0b0000000000000000000000000001000000011110000100100001001000010010ULL,
-    //     0b0001001000010010011100100110011000000110000000000000000000000000ULL
-    // };
-    // m_put(character_to_pixels, "♫", note, sizeof(note));
-
-    // uint64_t hash[2] = {
-    //     0b0000000000000000000000000000100000101100001111000111010000100100ULL,
-    //     0b0011110001110100001001000010000000000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "♯", hash, sizeof(hash));
-
-    // uint64_t recycle[2] = {
-    //     0b0000000000000000000000000000000000000000000110000011110000111100ULL,
-    //     0b0101101010011011100110110111111100000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "♳", recycle, sizeof(recycle));
-
-    // uint64_t plus[2] = {
-    //     0b0000000000000000000000000000000000000000111111111110011111100111ULL,
-    //     0b1000000111100111111001111111111100000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "⚃", plus, sizeof(plus));
-    
-    // uint64_t pick[2] = {
-    //     0b00000000000000000000000000001110001110000011100001111000100110ULL,
-    //     0b110001100000011000000010000000000000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "⛏", pick, sizeof(pick));
-
-    // uint64_t hook[2] = {
-    //     0b0000000000000000000000000111100010000100000001000000010000001100ULL,
-    //     0b0001100000110000001100000111100000110000001100000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "⚳", hook, sizeof(hook));
-
-    // uint64_t spike_ball[2] = {
-    //     0b0000000000000000000000000000100000001000000010000000100000010100ULL,
-    //     0b0111011100101010000101000000100000000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "⚶", spike_ball, sizeof(spike_ball));
-
-    // uint64_t star[2] = {
-    //     0b0000000000000000000000000000000000000100000011100111111111111111ULL,
-    //     0b0001111100011111000110110011000100000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "⭑", star, sizeof(star));
-
-    // uint64_t moon[2] = {
-    //     0b0000000000000000000000000011000001100000011000001110000011100000ULL,
-    //     0b1110000001110000001111110001111100000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "⏾", moon, sizeof(moon));
-
-
-    // uint64_t circle[2] = {
-    //     0b0000000000000000000000000000000000111000011111001111111011111111ULL,
-    //     0b1111111001111100001110000000000000000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "●", circle, sizeof(circle));
-
-    // uint64_t little_circle[2] = {
-    //     0b0000000000000000000000000000000000010000001110000111110011111110ULL,
-    //     0b0111110000111000000100000000000000000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "•", little_circle, sizeof(little_circle));
-
-    // uint64_t snowman[2] = {
-    //     0b0000000000000000000000000100010000010000011011001110100010101010ULL,
-    //     0b0100010010000010010001000011100000000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "☃", snowman, sizeof(snowman));
-
-    // uint64_t heart[2] = {
-    //     0b0000000000000000000000000000000001101110111111111111111101111110ULL,
-    //     0b0111110000111000000100000000000000000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "♥", heart, sizeof(heart));
-
-    // uint64_t middle_stub[2] = {
-    //     0b0000000000000000000000000000000000000000000000000000000000110000ULL,
-    //     0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "⠂", middle_stub, sizeof(middle_stub));
-
-    // uint64_t dots_3[2] = {
-    //     0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-    //     0b0000000000000000010101101101011000000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "…", dots_3, sizeof(dots_3));
-
-    // uint64_t dots_4[2] = {
-    //     0b0000000000000000000000000000000000000000000000000000000000000000ULL,
-    //     0b0000000000100100001101100000000000100100001101100000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, "⣤", dots_4, sizeof(dots_4));
-
-    // uint64_t semicolon[2] = {
-    //     0b0000000000000000000000000000000000000000000110000011100000000000ULL,
-    //     0b0000000000000000000110000011100000000000000000000000000000000000ULL,
-    // };
-    // m_put(character_to_pixels, ":", semicolon, sizeof(semicolon));
-
-
-
-    return character_to_pixels;
-}
-
-void print_character_map(Map* character_map) {
-
-    Element** charcters = map_elements(character_map);
-    for (int i = 0; i < character_map->len; ++i) {
-        Element* element = charcters[i];
-        printf(element->key);
-    }
-    free(charcters);
+
+    ╺ right_stub
+        0b0000000000000000000000000000000000000000000000000000000000000000ULL,
+        0b0000111100001111000000000000000000000000000000000000000000000000ULL,
+
+    ╴ left_stub
+        0b0000000000000000000000000000000000000000000000000000000000000000ULL,
+        0b1111000000000000000000000000000000000000000000000000000000000000ULL,
+
+    ♫ note
+        0b0000000000000000000000000001000000011110000100100001001000010010ULL,
+        0b0001001000010010011100100110011000000110000000000000000000000000ULL,
+
+    ♯ hash
+        0b0000000000000000000000000000100000101100001111000111010000100100ULL,
+        0b0011110001110100001001000010000000000000000000000000000000000000ULL,
+
+    ♳ recycle
+        0b0000000000000000000000000000000000000000000110000011110000111100ULL,
+        0b0101101010011011100110110111111100000000000000000000000000000000ULL,
+
+    ⚃ plus
+        0b0000000000000000000000000000000000000000111111111110011111100111ULL,
+        0b1000000111100111111001111111111100000000000000000000000000000000ULL,
+
+    ⛏ pick
+        0b00000000000000000000000000001110001110000011100001111000100110ULL,
+        0b110001100000011000000010000000000000000000000000000000000000000ULL,
+
+    ⚳ hook
+        0b0000000000000000000000000111100010000100000001000000010000001100ULL,
+        0b0001100000110000001100000111100000110000001100000000000000000000ULL,
+
+    ⚶ spike_ball
+        0b0000000000000000000000000000100000001000000010000000100000010100ULL,
+        0b0111011100101010000101000000100000000000000000000000000000000000ULL,
+
+    ⭑ star
+        0b0000000000000000000000000000000000000100000011100111111111111111ULL,
+        0b0001111100011111000110110011000100000000000000000000000000000000ULL,
+
+    ⏾ moon
+        0b0000000000000000000000000011000001100000011000001110000011100000ULL,
+        0b1110000001110000001111110001111100000000000000000000000000000000ULL,
+
+    ● circle
+        0b0000000000000000000000000000000000111000011111001111111011111111ULL,
+        0b1111111001111100001110000000000000000000000000000000000000000000ULL,
+
+    • little_circle
+        0b0000000000000000000000000000000000010000001110000111110011111110ULL,
+        0b0111110000111000000100000000000000000000000000000000000000000000ULL,
+
+    ☃ snowman
+        0b0000000000000000000000000100010000010000011011001110100010101010ULL,
+        0b0100010010000010010001000011100000000000000000000000000000000000ULL,
+
+    ♥ heart
+        0b0000000000000000000000000000000001101110111111111111111101111110ULL,
+        0b0111110000111000000100000000000000000000000000000000000000000000ULL,
+
+    ⠂ middle_stub
+        0b0000000000000000000000000000000000000000000000000000000000110000ULL,
+        0b0000000000000000000000000000000000000000000000000000000000000000ULL,
+
+    … dots_3
+        0b0000000000000000000000000000000000000000000000000000000000000000ULL,
+        0b0000000000000000010101101101011000000000000000000000000000000000ULL,
+
+    ⣤ dots_4
+        0b0000000000000000000000000000000000000000000000000000000000000000ULL,
+        0b0000000000100100001101100000000000100100001101100000000000000000ULL,
+
+    : semicolon
+        0b0000000000000000000000000000000000000000000110000011100000000000ULL,
+        0b0000000000000000000110000011100000000000000000000000000000000000ULL,
+*/
+
+void print_glyphs() {
+    for (int i = 0; i < GLYPH_COUNT; ++i) {
+        printf("%s", GLYPH_CHARACTERS[i]);
+    }
     printf("\n");
 }
 
-int count_shared_bits(uint64_t* a, uint64_t* b) {
-    uint64_t x_0 = ~(a[0] ^ b[0]);
-    uint64_t x_1 = ~(a[1] ^ b[1]);
+int count_shared_bits(const uint64_t* a, const uint64_t* b) {
+    return __builtin_popcountll(~(a[0] ^ b[0])) + __builtin_popcountll(~(a[1] ^ b[1]));
+}
+
+
+/*
+    Glyph matchers find the glyph sharing the most pixels with either variation of a
+    cell (the pixels closest to avg_1 or to avg_2). They return the glyph's index and
+    set is_first_best when first_variation was the better fit.
+
+    Every version gives exactly the same answer: the earlier glyph wins a tie and
+    first_variation wins a tie with second_variation. select_glyph_matcher picks the
+    fastest one the cpu supports.
+*/
+typedef int (*TImageGlyphMatcher)(const uint64_t* first_variation, const uint64_t* second_variation, int* is_first_best);
+
+/*
+    Matchers rank candidates with one number: the differing bits (fewest = most shared)
+    shifted above the candidate's position in the table order (glyph * 2, +1 for
+    second_variation). The smallest key is the best candidate, with ties going to
+    whichever came first. 128 differing bits would share nothing, which is what
+    the search starts from.
+*/
+#define GLYPH_KEY_SHIFT 6
+#define GLYPH_KEY_NONE (128 << GLYPH_KEY_SHIFT)
+
+static inline int glyph_from_key(int key, int* is_first_best) {
+    *is_first_best = !(key & 1);
+    return (key & ((1 << GLYPH_KEY_SHIFT) - 1)) >> 1;
+}
 
-    int count = 0;
-    while (x_0) {
-        x_0 &= (x_0 - 1); // clears lowest set bit
-        count++;
+static inline __attribute__((always_inline)) int match_glyph_popcount(
+    const uint64_t* first_variation,
+    const uint64_t* second_variation,
+    int* is_first_best
+) {
+    int best_key = GLYPH_KEY_NONE;
+    for (int i = 0; i < GLYPH_COUNT; ++i) {
+        const uint64_t* mask = GLYPH_MASKS[i];
+        int first_diff = __builtin_popcountll(mask[0] ^ first_variation[0]) + __builtin_popcountll(mask[1] ^ first_variation[1]);
+        int second_diff = __builtin_popcountll(mask[0] ^ second_variation[0]) + __builtin_popcountll(mask[1] ^ second_variation[1]);
+        int first_key = (first_diff << GLYPH_KEY_SHIFT) | (i << 1);
+        int second_key = (second_diff << GLYPH_KEY_SHIFT) | (i << 1) | 1;
+        int key = first_key < second_key ? first_key : second_key;
+        best_key = key < best_key ? key : best_key;
     }
-    while (x_1) {
-        x_1 &= (x_1 - 1);
-        count++;
+    return glyph_from_key(best_key, is_first_best);
+}
+
+int match_glyph_scalar(const uint64_t* first_variation, const uint64_t* second_variation, int* is_first_best) {
+    return match_glyph_popcount(first_variation, second_variation, is_first_best);
+}
+
+#ifdef TIMAGE_X86_DISPATCH
+
+// same as match_glyph_scalar but lets the compiler use the popcnt instruction
+__attribute__((target("popcnt")))
+int match_glyph_popcnt(const uint64_t* first_variation, const uint64_t* second_variation, int* is_first_best) {
+    return match_glyph_popcount(first_variation, second_variation, is_first_best);
+}
+
+// counts the set bits in each 64 bit lane (there's no popcount instruction for avx2 registers)
+__attribute__((target("avx2")))
+static inline __m256i popcount_lanes_avx2(__m256i v) {
+    const __m256i nibble_bits = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+    );
+    const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+    __m256i low = _mm256_and_si256(v, low_nibble);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble);
+    __m256i byte_counts = _mm256_add_epi8(
+        _mm256_shuffle_epi8(nibble_bits, low),
+        _mm256_shuffle_epi8(nibble_bits, high)
+    );
+    return _mm256_sad_epu8(byte_counts, _mm256_setzero_si256());
+}
+
+// two glyphs per register and both variations per pass, keys stay in registers until the end
+__attribute__((target("avx2")))
+int match_glyph_avx2(const uint64_t* first_variation, const uint64_t* second_variation, int* is_first_best) {
+    __m256i first = _mm256_setr_epi64x(first_variation[0], first_variation[1], first_variation[0], first_variation[1]);
+    __m256i second = _mm256_setr_epi64x(second_variation[0], second_variation[1], second_variation[0], second_variation[1]);
+
+    // each glyph's key ends up in both lanes of its half of the register
+    __m256i order = _mm256_setr_epi64x(0, 0, 2, 2);
+    const __m256i order_step = _mm256_set1_epi64x(4);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i padding = _mm256_setr_epi64x(0, 0, GLYPH_KEY_NONE, GLYPH_KEY_NONE);
+    __m256i best = _mm256_set1_epi64x(GLYPH_KEY_NONE);
+    for (int i = 0; i < GLYPH_TABLE_SIZE; i += 2) {
+        __m256i masks = _mm256_loadu_si256((const __m256i*)GLYPH_MASKS[i]);
+        __m256i first_diff = popcount_lanes_avx2(_mm256_xor_si256(masks, first));
+        __m256i second_diff = popcount_lanes_avx2(_mm256_xor_si256(masks, second));
+
+        // add each glyph's two halves together
+        first_diff = _mm256_add_epi64(first_diff, _mm256_shuffle_epi32(first_diff, _MM_SHUFFLE(1, 0, 3, 2)));
+        second_diff = _mm256_add_epi64(second_diff, _mm256_shuffle_epi32(second_diff, _MM_SHUFFLE(1, 0, 3, 2)));
+
+        __m256i first_key = _mm256_or_si256(_mm256_slli_epi64(first_diff, GLYPH_KEY_SHIFT), order);
+        __m256i second_key = _mm256_or_si256(_mm256_slli_epi64(second_diff, GLYPH_KEY_SHIFT), _mm256_or_si256(order, one));
+        if (i + 1 >= GLYPH_COUNT) {
+            // the zeroed padding mask isn't a real glyph
+            first_key = _mm256_add_epi64(first_key, padding);
+            second_key = _mm256_add_epi64(second_key, padding);
+        }
+
+        // keys are well under 32 bits so the unsigned 32 bit min works on the 64 bit lanes
+        best = _mm256_min_epu32(best, _mm256_min_epu32(first_key, second_key));
+        order = _mm256_add_epi64(order, order_step);
     }
-    return count;
+
+    __m128i half = _mm_min_epu32(_mm256_castsi256_si128(best), _mm256_extracti128_si256(best, 1));
+    int best_key = _mm_cvtsi128_si32(half);
+    return glyph_from_key(best_key, is_first_best);
+}
+
+#endif
+
+TImageGlyphMatcher select_glyph_matcher() {
+#ifdef TIMAGE_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return match_glyph_avx2;
+    if (__builtin_cpu_supports("popcnt")) return match_glyph_popcnt;
+#endif
+    return match_glyph_scalar;
 }
 
 int x_y_to_index(int x, int y, int image_width, int channels) {
@@ -11294,6 +11436,7 @@ void kmeans_for_colors(
     int image_width_cells,
     int CURSOR_WIDTH,
     int CURSOR_HEIGHT,
+    int kmeans_iterations,
 
     int* avg_1_r,
     int* avg_1_g,
@@ -11316,82 +11459,69 @@ void kmeans_for_colors(
     *avg_2_g = new_image[avg_2_in+1];
     *avg_2_b = new_image[avg_2_in+2];
     *avg_2_a = new_image[avg_2_in+3];
-    List* avg_1 = new_list();
-    List* avg_2 = new_list();
-    for (int k = 0; k < KMEANS_ITERATIONS; k++) {
+    for (int k = 0; k < kmeans_iterations; k++) {
         
-        // sort into groups
-        for (int x = 0; x < CURSOR_WIDTH; x++) {
-            for (int y = 0; y < CURSOR_HEIGHT; y++) {
+        // sort into groups, summing each group as we go
+        int sum_1_r = 0, sum_1_g = 0, sum_1_b = 0, sum_1_a = 0, len_1 = 0;
+        int sum_2_r = 0, sum_2_g = 0, sum_2_b = 0, sum_2_a = 0, len_2 = 0;
+        for (int y = 0; y < CURSOR_HEIGHT; y++) {
+            int row = get_image_index(c_x, c_y, 0, y, image_width_cells, CURSOR_WIDTH, CURSOR_HEIGHT);
+            for (int x = 0; x < CURSOR_WIDTH; x++) {
                 
-                int i = get_image_index(c_x, c_y, x, y, image_width_cells, CURSOR_WIDTH, CURSOR_HEIGHT);
+                int i = row + x * 4;
                 uint8_t r = new_image[i];
                 uint8_t g = new_image[i+1];
                 uint8_t b = new_image[i+2];
                 uint8_t a = new_image[i+3];
                 int dist_1 = dist(*avg_1_r, *avg_1_g, *avg_1_g, *avg_1_a, r, g, b, a);
                 int dist_2 = dist(*avg_2_r, *avg_2_g, *avg_2_g, *avg_2_a, r, g, b, a);
-                int* coor = malloc(sizeof(int) * 2);
-                coor[0] = x;
-                coor[1] = y;
                 if (dist_1 < dist_2) {
-                    l_push(avg_1, coor);
+                    sum_1_r += r;
+                    sum_1_g += g;
+                    sum_1_b += b;
+                    sum_1_a += a;
+                    ++len_1;
                 }
                 else {
-                    l_push(avg_2, coor);
+                    sum_2_r += r;
+                    sum_2_g += g;
+                    sum_2_b += b;
+                    sum_2_a += a;
+                    ++len_2;
                 }
             }
         }
 
-        // avoid empty groups
-        if (avg_1->len == 0) {
-            int* coor = l_pop(avg_2);
-            l_push(avg_1, coor);
-        }
-        if (avg_2->len == 0) {
-            int* coor = l_pop(avg_1);
-            l_push(avg_2, coor);
+        // avoid empty groups, moving over the last pixel of the cell (it's the last one 
+        // that was sorted into the full group)
+        if (len_1 == 0 || len_2 == 0) {
+            uint8_t r = new_image[avg_2_in];
+            uint8_t g = new_image[avg_2_in+1];
+            uint8_t b = new_image[avg_2_in+2];
+            uint8_t a = new_image[avg_2_in+3];
+            int direction = len_1 == 0? 1 : -1;
+            sum_1_r += direction * r;
+            sum_1_g += direction * g;
+            sum_1_b += direction * b;
+            sum_1_a += direction * a;
+            len_1 += direction;
+            sum_2_r -= direction * r;
+            sum_2_g -= direction * g;
+            sum_2_b -= direction * b;
+            sum_2_a -= direction * a;
+            len_2 -= direction;
         }
 
         // determine new averages
-        *avg_1_r = 0;
-        *avg_1_g = 0;
-        *avg_1_b = 0;
-        *avg_1_a = 0;
-        *avg_2_r = 0;
-        *avg_2_g = 0;
-        *avg_2_b = 0;
-        *avg_2_a = 0;
-        for (int i = 0; i < avg_1->len; ++i) {
-            int* coor = l_get(avg_1, i);
-            int index = get_image_index(c_x, c_y, coor[0], coor[1], image_width_cells, CURSOR_WIDTH, CURSOR_HEIGHT);
-            *avg_1_r += new_image[index];
-            *avg_1_g += new_image[index+1];
-            *avg_1_b += new_image[index+2];
-            *avg_1_a += new_image[index+3];
-        }
-        *avg_1_r /= avg_1->len;
-        *avg_1_g /= avg_1->len;
-        *avg_1_b /= avg_1->len;
-        *avg_1_a /= avg_1->len;
-        l_clear(avg_1, 1);
-        for (int i = 0; i < avg_2->len; ++i) {
-            int* coor = l_get(avg_2, i);
-            int index = get_image_index(c_x, c_y, coor[0], coor[1], image_width_cells, CURSOR_WIDTH, CURSOR_HEIGHT);
-            *avg_2_r += new_image[index];
-            *avg_2_g += new_image[index+1];
-            *avg_2_b += new_image[index+2];
-            *avg_2_a += new_image[index+3];
-        }
-        *avg_2_r /= avg_2->len;
-        *avg_2_g /= avg_2->len;
-        *avg_2_b /= avg_2->len;
-        *avg_2_a /= avg_2->len;
-        l_clear(avg_2, 1);
-
+        *avg_1_r = sum_1_r / len_1;
+        *avg_1_g = sum_1_g / len_1;
+        *avg_1_b = sum_1_b / len_1;
+        *avg_1_a = sum_1_a / len_1;
+        *avg_2_r = sum_2_r / len_2;
+        *avg_2_g = sum_2_g / len_2;
+        *avg_2_b = sum_2_b / len_2;
+        *avg_2_a = sum_2_a / len_2;
     }
-    free_list(avg_1, 1);
-    free_list(avg_2, 1);
 
 }
 
@@ -11408,6 +11538,21 @@ typedef struct {
     TImageColor background_color;
 } TImageCell;
 
+/*
+    A cell packed into 8 bytes, for filling one flat array instead of a TImageCell per cell.
+
+    glyph indexes GLYPH_CHARACTERS (see packed_cell_unicode), cells the image doesn't
+    reach have glyph EMPTY_CELL and should be printed as a reset and a space.
+*/
+#define EMPTY_CELL 255
+
+typedef struct {
+    uint8_t glyph;
+    TImageColor text_color;
+    TImageColor background_color;
+    uint8_t unused; // rounds the cell up to 8 bytes
+} TImagePackedCell;
+
 
 void free_image_cells(TImageCell** cells, int display_width, int display_height) {
    int length = display_width * display_height;
@@ -11421,304 +11566,4597 @@ void free_image_cells(TImageCell** cells, int display_width, int display_height)
    free(cells);
 }
 
-/**
- * Converts an image file to an array of cells containing the ansii color codes and unicode characters. 
- * This 1d array can be printed adding a newline every display_width cells to display the image in the terminal.
- * 
- * If the image size won't fit perfectly in display_width x display_height cells, then the image will be scaled
- * to fit in the area (but not distorted).
- * 
- * You can call the free_image_cells method above to clean up the output of this function after you're done with it.
- */
-TImageCell** convert_image_to_ansii_cells(char* path, int display_width, int display_height) {
 
-    TImageCell** cells = calloc(display_height * display_width, sizeof(TImageCell*));
+/*
+    A persistent pool of threads for splitting up conversion work.
 
+    pool_run(pool, task_count, task, arg) calls task(arg, i) for every i in [0, task_count)
+    across the pool and returns once they've all finished, the calling thread pitches in
+    too. Each thread starts out with an even slice of the tasks and works through it from
+    the front, when it runs out it steals half of what's left from the back of another
+    thread's slice, so a few slow tiles don't leave the other threads sitting idle.
 
-    // load map
-    Map* character_to_pixels = make_character_map();
-    // print_character_map(character_to_pixels);
+    The threads sleep between runs and are reused until free_thread_pool. A pool runs one
+    batch at a time, so don't share one between threads that convert at the same time.
+*/
+typedef void (*TImageTask)(void* arg, int task);
 
-    // LOAD image
-    int image_width, image_height, channels;
-    uint8_t *image = stbi_load(path, &image_width, &image_height, &channels, 0);
-    if (!image) {
-        printf("Failed to load image: %s\n", stbi_failure_reason());
-        exit(-1);
-    }
+typedef struct {
+    pthread_mutex_t lock;
+    int next; // taken by the owner
+    int end; // stolen by everyone else
+} TImageTaskQueue;
 
-    int CURSOR_WIDTH = 8;
-    int CURSOR_HEIGHT = 19;
-    double image_ratio = (double)image_width / (double)image_height;
-    double terminal_ratio = (double)(display_width * CURSOR_WIDTH) / (double)(display_height * CURSOR_HEIGHT);
+typedef struct {
+    int thread_count; // including the thread calling pool_run
+    pthread_t* threads;
+    TImageTaskQueue* queues; // one per thread, queues[0] belongs to the caller
 
-    // DETERMINE pixels per cell
-    double pixels_per_cell_pixel;
-    if (image_ratio > terminal_ratio) {
-        // if image is wider than terminal portionally, use the width to determine the pixel ratio
-        pixels_per_cell_pixel = (double)image_width / (display_width * CURSOR_WIDTH);
-    }
-    else {
-        // if the image is taller than terminal portionally, use the height to determine the pixel ratio
-        pixels_per_cell_pixel = (double)image_height / (display_height * CURSOR_HEIGHT);
-    }
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    int generation;
+    int busy_threads;
+    int is_shutting_down;
 
+    TImageTask task;
+    void* arg;
+} TImageThreadPool;
 
-    // SCALE image with bilinear interpolation
-    int new_width = image_width / pixels_per_cell_pixel;
-    int new_height = image_height / pixels_per_cell_pixel;
+typedef struct {
+    TImageThreadPool* pool;
+    int id;
+} TImageWorkerStart;
 
-    // ensure multiples of 8
-    while(new_width % 8 != 0) {
-        --new_width;
-    }
-    while(new_height % 8 != 0) {
-        --new_height;
+static void pool_mem_error_exit_failing() {
+    fprintf(stderr, "Failed to allocate memory for the thread pool. Exiting...");
+    exit(EXIT_FAILURE);
+}
+
+static int take_task(TImageTaskQueue* queue, int* task) {
+    pthread_mutex_lock(&queue->lock);
+    int found = queue->next < queue->end;
+    if (found) {
+        *task = queue->next++;
     }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
 
+static int steal_tasks(TImageThreadPool* pool, int thief) {
+    for (int offset = 1; offset < pool->thread_count; ++offset) {
+        TImageTaskQueue* victim = &pool->queues[(thief + offset) % pool->thread_count];
 
-    int new_image_length = new_height * new_width * 4;
-    uint8_t* new_image = malloc(sizeof(uint8_t) * new_image_length);
-    for (int x = 0; x < new_width; x++) {
-        for (int y = 0; y < new_height; y++) {
-            // find coordinates in the source image
-            float gx = (x + 0.5f) * image_width / new_width  - 0.5f;
-            float gy = (y + 0.5f) * image_height / new_height - 0.5f;
+        pthread_mutex_lock(&victim->lock);
+        int remaining = victim->end - victim->next;
+        int start = victim->end - (remaining + 1) / 2;
+        int end = victim->end;
+        if (remaining > 0) {
+            victim->end = start;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (remaining > 0) {
+            TImageTaskQueue* own = &pool->queues[thief];
+            pthread_mutex_lock(&own->lock);
+            own->next = start;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            return 1;
+        }
+    }
+    return 0;
+}
 
-            int x0 = floor(gx);
-            int x1 = x0 + 1;
-            int y0 = floor(gy);
-            int y1 = y0 + 1;
+static void work_on_tasks(TImageThreadPool* pool, int id) {
+    int task;
+    do {
+        while (take_task(&pool->queues[id], &task)) {
+            pool->task(pool->arg, task);
+        }
+    } while (steal_tasks(pool, id));
+}
+
+static void* pool_worker(void* start_arg) {
+    TImageWorkerStart* start = start_arg;
+    TImageThreadPool* pool = start->pool;
+    int id = start->id;
+    free(start);
+
+    // a run can be posted before this thread gets going, so count from the generation
+    // the pool was made with rather than whatever it is by now
+    int seen_generation = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->generation == seen_generation && !pool->is_shutting_down) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->is_shutting_down) break;
+        seen_generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
 
-            float dx = gx - x0;
-            float dy = gy - y0;
+        work_on_tasks(pool, id);
 
-            // clamp coordinates to image boundaries
-            x0 = clamp(x0, 0, image_width-1);
-            x1 = clamp(x1, 0, image_width-1);
-            y0 = clamp(y0, 0, image_height-1);
-            y1 = clamp(y1, 0, image_height-1);
-
-            // sample the four neighboring pixels
-            uint8_t top_left_r = image[y0 * image_width * channels + x0 * channels];
-            uint8_t top_left_g = image[y0 * image_width * channels + x0 * channels + 1];
-            uint8_t top_left_b = image[y0 * image_width * channels + x0 * channels + 2];
-            uint8_t top_left_a = 255;
-            if (channels > 3) top_left_a = image[y0 * image_width * channels + x0 * channels + 3];
-
-            uint8_t top_right_r = image[y0 * image_width * channels + x1 * channels];
-            uint8_t top_right_g = image[y0 * image_width * channels + x1 * channels + 1];
-            uint8_t top_right_b = image[y0 * image_width * channels + x1 * channels + 2];
-            uint8_t top_right_a = 255;
-            if (channels > 3) top_right_a = image[y0 * image_width * channels + x1 * channels + 3];
-
-            uint8_t bottom_left_r = image[y1 * image_width * channels + x0 * channels];
-            uint8_t bottom_left_g = image[y1 * image_width * channels + x0 * channels + 1];
-            uint8_t bottom_left_b = image[y1 * image_width * channels + x0 * channels + 2];
-            uint8_t bottom_left_a = 255;
-            if (channels > 3) bottom_left_a = image[y1 * image_width * channels + x0 * channels + 3];
-
-            uint8_t bottom_right_r = image[y1 * image_width * channels + x1 * channels];
-            uint8_t bottom_right_g = image[y1 * image_width * channels + x1 * channels + 1];
-            uint8_t bottom_right_b = image[y1 * image_width * channels + x1 * channels + 2];
-            uint8_t bottom_right_a = 255;
-            if (channels > 3) bottom_right_a = image[y1 * image_width * channels + x1 * channels + 3];
-
-            // interpolate horizontally then vertically
-            uint8_t top_r;
-            uint8_t top_g;
-            uint8_t top_b;
-            uint8_t top_a = 255;
-            lerp(
-                &top_r,
-                &top_g,
-                &top_b,
-                &top_a,
-                top_left_r,
-                top_left_g,
-                top_left_b,
-                top_left_a,
-                top_right_r,
-                top_right_g,
-                top_right_b,
-                top_right_a,
-                dx
-            );
-            uint8_t bottom_r;
-            uint8_t bottom_g;
-            uint8_t bottom_b;
-            uint8_t bottom_a = 255;
-            lerp(
-                &bottom_r,
-                &bottom_g,
-                &bottom_b,
-                &bottom_a,
-                bottom_left_r,
-                bottom_left_g,
-                bottom_left_b,
-                bottom_left_a,
-                bottom_right_r,
-                bottom_right_g,
-                bottom_right_b,
-                bottom_right_a,
-                dx
-            );
-            uint8_t r;
-            uint8_t g;
-            uint8_t b;
-            uint8_t a = 255;
-            lerp(
-                &r,
-                &g,
-                &b,
-                &a,
-                top_r,
-                top_g,
-                top_b,
-                top_a,
-                bottom_r,
-                bottom_g,
-                bottom_b,
-                bottom_a,
-                dy
-            );
-            int index = (y * new_width + x) * 4;
-            new_image[index] = r;
-            new_image[index+1] = g;
-            new_image[index+2] = b;
-            new_image[index+3] = a;
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy_threads == 0) {
+            pthread_cond_signal(&pool->work_done);
         }
     }
-   //  stbi_write_png("test/resized.png", new_width, new_height, 4, new_image, new_width * 4);
-
-
-    // DETERMINE characters and colors for each cell
-    int image_width_cells = floor((double)new_width / (double)CURSOR_WIDTH);
-    int image_height_cells = floor((double)new_height / (double)CURSOR_HEIGHT);
-    for (int c_y = 0; c_y < image_height_cells; c_y++) {
-        for (int c_x = 0; c_x < image_width_cells; c_x++) {
-
-            // kmeans determine color pair for cells
-            int avg_1_r, avg_1_g, avg_1_b, avg_1_a;
-            int avg_2_r, avg_2_g, avg_2_b, avg_2_a;
-            kmeans_for_colors(
-                new_image,
-                c_x,
-                c_y,
-                image_width_cells,
-                CURSOR_WIDTH,
-                CURSOR_HEIGHT,
-                &avg_1_r, 
-                &avg_1_g, 
-                &avg_1_b, 
-                &avg_1_a,
-                &avg_2_r, 
-                &avg_2_g, 
-                &avg_2_b, 
-                &avg_2_a
-            );
-
-            // determine character that matches the pixels the best
-            uint64_t first_variation[2] = {0, 0}; // avg_1 is set or is text
-            uint64_t second_variation[2] = {0, 0}; // avg_2 is set or is text
-            for (int x = 0; x < CURSOR_WIDTH; x++) {
-                for (int y = 0; y < CURSOR_HEIGHT; y++) {
-
-                    int i = get_image_index(c_x, c_y, x, y, image_width_cells, CURSOR_WIDTH, CURSOR_HEIGHT);
-
-                    // index = (x + y*width) * 4
-                    int pixel_x = (i / 4) % new_width;
-                    int pixel_y = ((i / 4) - x) / new_width;
-                    int cursor_x = pixel_x / CURSOR_WIDTH;
-                    int cursor_y = pixel_y / CURSOR_HEIGHT;
-                    uint8_t r = new_image[i];
-                    uint8_t g = new_image[i+1];
-                    uint8_t b = new_image[i+2];
-                    uint8_t a = new_image[i+3];
-                    int dist_1 = dist(avg_1_r, avg_1_g, avg_1_b, avg_1_a, r, g, b, a);
-                    int dist_2 = dist(avg_2_r, avg_2_g, avg_2_b, avg_2_a, r, g, b, a);
-
-                    int index = x + y * CURSOR_WIDTH;
-                    int is_second_uint = 0;
-                    if (index > 64) {
-                        is_second_uint = 1;
-                        index %= 64;
-                    }
-                    
-                    if (dist_1 < dist_2) {
-                        set_bit(
-                            is_second_uint? &first_variation[1] : &first_variation[0],
-                            63-index
-                        );
-                    }
-                    else {
-                        set_bit(
-                            is_second_uint? &second_variation[1] : &second_variation[0],
-                            63-index
-                        );
-                    }
-                }
-            }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/*
+    Makes a pool with thread_count threads including the caller's (so thread_count - 1
+    are started), thread_count <= 0 uses one per online cpu.
+*/
+TImageThreadPool* new_thread_pool(int thread_count) {
+    if (thread_count <= 0) {
+        thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+        if (thread_count <= 0) thread_count = 1;
+    }
 
+    TImageThreadPool* pool = calloc(1, sizeof(TImageThreadPool));
+    if (pool == NULL) {
+        pool_mem_error_exit_failing();
+    }
+    pool->thread_count = thread_count;
+    pool->threads = calloc(thread_count, sizeof(pthread_t));
+    pool->queues = calloc(thread_count, sizeof(TImageTaskQueue));
+    if (pool->threads == NULL || pool->queues == NULL) {
+        pool_mem_error_exit_failing();
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    for (int i = 0; i < thread_count; ++i) {
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+    }
 
-            int is_first_best = 1;
-            int best_variation_closeness = 0;
-            char* element_key = "";
+    for (int i = 1; i < thread_count; ++i) {
+        TImageWorkerStart* start = malloc(sizeof(TImageWorkerStart));
+        if (start == NULL) {
+            pool_mem_error_exit_failing();
+        }
+        start->pool = pool;
+        start->id = i;
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, start) != 0) {
+            fprintf(stderr, "Failed to start a thread pool worker. Exiting...");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-            Element** elements = map_elements(character_to_pixels);
-            for (int i = 0; i < character_to_pixels->len; ++i) {
-                Element* element = elements[i];
-                uint64_t* bits = element->data;
-                
-                int closeness = count_shared_bits(bits, first_variation);
-                if (closeness > best_variation_closeness) {
-                    is_first_best = 1;
-                    best_variation_closeness = closeness;
-                    element_key = element->key;
-                }
+    return pool;
+}
 
-                closeness = count_shared_bits(bits, second_variation);
-                if (closeness > best_variation_closeness) {
-                    is_first_best = 0;
-                    best_variation_closeness = closeness;
-                    element_key = element->key;
-                }
-            }
-            free(elements);
-            
+void free_thread_pool(TImageThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->is_shutting_down = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
 
+    for (int i = 1; i < pool->thread_count; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (int i = 0; i < pool->thread_count; ++i) {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->threads);
+    free(pool->queues);
+    free(pool);
+}
 
-            // add cell
-            TImageCell* cell = malloc(sizeof(TImageCell));
-            cell->unicode = strdup(element_key);
-            int index = c_x + c_y * display_width;
-            cells[index] = cell;
-            if (is_first_best) {
-                cell->text_color.r = avg_1_r;
-                cell->text_color.g = avg_1_g;
-                cell->text_color.b = avg_1_b;
-                cell->background_color.r = avg_2_r;
-                cell->background_color.g = avg_2_g;
-                cell->background_color.b = avg_2_b;
-            }
-            else {
-                cell->text_color.r = avg_2_r;
-                cell->text_color.g = avg_2_g;
-                cell->text_color.b = avg_2_b;
-                cell->background_color.r = avg_1_r;
-                cell->background_color.g = avg_1_g;
-                cell->background_color.b = avg_1_b;
-            }
+/*
+    Runs task(arg, i) for i in [0, task_count) on the pool, returning when all are done.
+    A NULL pool runs them in order on the calling thread.
+*/
+void pool_run(TImageThreadPool* pool, int task_count, TImageTask task, void* arg) {
+    if (pool == NULL || pool->thread_count == 1 || task_count <= 1) {
+        for (int i = 0; i < task_count; ++i) {
+            task(arg, i);
         }
+        return;
     }
 
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    for (int i = 0; i < pool->thread_count; ++i) {
+        TImageTaskQueue* queue = &pool->queues[i];
+        pthread_mutex_lock(&queue->lock);
+        queue->next = (int)((long)task_count * i / pool->thread_count);
+        queue->end = (int)((long)task_count * (i + 1) / pool->thread_count);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    pool->busy_threads = pool->thread_count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
 
-    free(image);
-    free(new_image);
-    free_map(character_to_pixels, 1);
-
+    work_on_tasks(pool, 0);
 
-    return cells;
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy_threads > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
 }
 
-#endif
\ No newline at end of file
+
+/*
+    A reusable image converter.
+
+    Owns everything convert_image_to_ansii_cells would otherwise rebuild on each
+    call: the scaled image and the output cells. The buffers only
+    ever grow, so once a converter has seen your largest display size converting
+    again doesn't allocate anything itself (stbi_load still allocates the decoded
+    image).
+
+    Used like so:
+    ```
+    TImageConverter* converter = new_image_converter();
+    converter->kmeans_iterations = 2;
+    converter->thread_count = 4;
+
+    TImageCell** cells = convert_image_with_converter(converter, "test/wizards.jpg", 80, 24);
+    // ... print the cells just like convert_image_to_ansii_cells output ...
+
+    // cells belong to the converter, so don't call free_image_cells on them
+    free_image_converter(converter);
+    ```
+*/
+typedef struct {
+    // options
+    int kmeans_iterations;
+    int thread_count; // 1 converts on the calling thread, 0 uses one thread per cpu
+    TImageGlyphMatcher match_glyph;
+    int is_jpeg_downscaled; // decode big jpegs at 1/2, 1/4 or 1/8 size when that's still enough for the cells
+    int is_thumbnail_used; // decode the thumbnail in a jpeg's EXIF data instead when it's big enough
+
+    TImageThreadPool* pool; // started on first use and kept for later conversions
+
+    // scratch buffers, sized to the largest geometry seen so far
+    uint8_t* new_image;
+    size_t new_image_capacity;
+    TImagePackedCell* packed_cells;
+    size_t packed_cells_capacity;
+    TImageCell* cell_storage;
+    TImageCell** cells;
+    size_t cells_capacity; // in cells
+} TImageConverter;
+
+int CURSOR_WIDTH = 8;
+int CURSOR_HEIGHT = 19;
+
+
+static void converter_mem_error_exit_failing() {
+    fprintf(stderr, "Failed to allocate memory for the image converter. Exiting...");
+    exit(EXIT_FAILURE);
+}
+
+static void* grow_buffer(void* buffer, size_t* capacity, size_t needed) {
+    if (needed <= *capacity) return buffer;
+
+    void* grown = realloc(buffer, needed);
+    if (grown == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    *capacity = needed;
+    return grown;
+}
+
+TImageConverter* new_image_converter() {
+    TImageConverter* converter = calloc(1, sizeof(TImageConverter));
+    if (converter == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    converter->kmeans_iterations = KMEANS_ITERATIONS;
+    converter->thread_count = 1;
+    converter->match_glyph = select_glyph_matcher();
+    converter->is_jpeg_downscaled = 1;
+
+    return converter;
+}
+
+void free_image_converter(TImageConverter* converter) {
+    if (converter->pool != NULL) {
+        free_thread_pool(converter->pool);
+    }
+    free(converter->new_image);
+    free(converter->packed_cells);
+    free(converter->cell_storage);
+    free(converter->cells);
+    free(converter);
+}
+
+
+/*
+    Pixels already in memory, like a decoded image or a screenshot. Rows are stride bytes
+    apart, so a pixels can also be a part of a bigger buffer. The first four formats match
+    stb_image's channel counts.
+
+    Used like so:
+    ```
+    TImagePixels pixels = image_pixels(frame, 1920, 1080, PIXEL_FORMAT_BGRA, 0);
+    TImagePackedCell* cells = convert_pixels_to_packed_cells(converter, &pixels, 80, 24, NULL);
+    ```
+*/
+typedef enum {
+    PIXEL_FORMAT_GRAY = 1,
+    PIXEL_FORMAT_GRAY_ALPHA = 2,
+    PIXEL_FORMAT_RGB = 3,
+    PIXEL_FORMAT_RGBA = 4,
+    PIXEL_FORMAT_BGR = 5,
+    PIXEL_FORMAT_BGRA = 6,
+} TImagePixelFormat;
+
+typedef struct {
+    const uint8_t* data;
+    int width;
+    int height;
+    TImagePixelFormat format;
+    size_t stride; // bytes from one row to the next
+} TImagePixels;
+
+// bytes per pixel, then where red, green, blue and alpha are in a pixel (-1 for opaque)
+static const int8_t PIXEL_LAYOUTS[7][5] = {
+    {0, 0, 0, 0, -1},
+    {1, 0, 0, 0, -1}, // PIXEL_FORMAT_GRAY
+    {2, 0, 0, 0, 1}, // PIXEL_FORMAT_GRAY_ALPHA
+    {3, 0, 1, 2, -1}, // PIXEL_FORMAT_RGB
+    {4, 0, 1, 2, 3}, // PIXEL_FORMAT_RGBA
+    {3, 2, 1, 0, -1}, // PIXEL_FORMAT_BGR
+    {4, 2, 1, 0, 3}, // PIXEL_FORMAT_BGRA
+};
+
+int pixel_format_bytes(TImagePixelFormat format) {
+    return PIXEL_LAYOUTS[format][0];
+}
+
+/*
+    Describes width x height pixels at data, a stride of 0 means the rows are right after each other.
+*/
+TImagePixels image_pixels(const uint8_t* data, int width, int height, TImagePixelFormat format, size_t stride) {
+    TImagePixels pixels;
+    pixels.data = data;
+    pixels.width = width;
+    pixels.height = height;
+    pixels.format = format;
+    pixels.stride = stride != 0? stride : (size_t)width * pixel_format_bytes(format);
+    return pixels;
+}
+
+
+/*
+    Determines the size the image is scaled to so it fills as much of
+    display_width x display_height cells as it can without being distorted.
+*/
+void scaled_image_size(
+    int image_width,
+    int image_height,
+    int display_width,
+    int display_height,
+    int* new_width,
+    int* new_height
+) {
+    double image_ratio = (double)image_width / (double)image_height;
+    double terminal_ratio = (double)(display_width * CURSOR_WIDTH) / (double)(display_height * CURSOR_HEIGHT);
+
+    // DETERMINE pixels per cell
+    double pixels_per_cell_pixel;
+    if (image_ratio > terminal_ratio) {
+        // if image is wider than terminal portionally, use the width to determine the pixel ratio
+        pixels_per_cell_pixel = (double)image_width / (display_width * CURSOR_WIDTH);
+    }
+    else {
+        // if the image is taller than terminal portionally, use the height to determine the pixel ratio
+        pixels_per_cell_pixel = (double)image_height / (display_height * CURSOR_HEIGHT);
+    }
+
+    *new_width = image_width / pixels_per_cell_pixel;
+    *new_height = image_height / pixels_per_cell_pixel;
+
+    // ensure multiples of 8
+    while(*new_width % 8 != 0) {
+        --*new_width;
+    }
+    while(*new_height % 8 != 0) {
+        --*new_height;
+    }
+}
+
+
+/*
+    The number of rows an image_width x image_height image fills when it's scaled to be
+    display_width cells wide, for showing an image at a width with the height to match.
+    To load an image before its size is known, use DISPLAY_HEIGHT_ANY for display_height.
+*/
+#define DISPLAY_HEIGHT_ANY (INT_MAX / CURSOR_HEIGHT)
+
+int display_height_for_width(int image_width, int image_height, int display_width) {
+    int new_width, new_height;
+    scaled_image_size(image_width, image_height, display_width, DISPLAY_HEIGHT_ANY, &new_width, &new_height);
+    int display_height = (new_height + CURSOR_HEIGHT - 1) / CURSOR_HEIGHT;
+    return display_height > 0? display_height : 1;
+}
+
+
+// columns whose source pixels are worked out at once when scaling
+#define SCALE_COLUMNS 256
+
+/*
+    Scales columns [x_start, x_end) of rows [y_start, y_end) of a new_width x new_height image (RGBA)
+    from pixels with bilinear interpolation. The rows are written to rows (new_width pixels each),
+    starting with row y_start, the other columns are left as they are.
+*/
+void scale_pixels_bilinear_area(
+    const TImagePixels* pixels,
+    uint8_t* rows,
+    int new_width,
+    int new_height,
+    int x_start,
+    int x_end,
+    int y_start,
+    int y_end
+) {
+    int image_width = pixels->width;
+    int image_height = pixels->height;
+    const int8_t* layout = PIXEL_LAYOUTS[pixels->format];
+    int bytes = layout[0];
+    int r_at = layout[1];
+    int g_at = layout[2];
+    int b_at = layout[3];
+    int a_at = layout[4];
+
+    // the source columns a column reads from are the same on every row, so they're found once for SCALE_COLUMNS columns at a time
+    int column_x0[SCALE_COLUMNS];
+    int column_x1[SCALE_COLUMNS];
+    float column_dx[SCALE_COLUMNS];
+    for (int chunk_start = x_start; chunk_start < x_end; chunk_start += SCALE_COLUMNS) {
+        int chunk_end = chunk_start + SCALE_COLUMNS < x_end? chunk_start + SCALE_COLUMNS : x_end;
+        for (int x = chunk_start; x < chunk_end; x++) {
+            // find coordinates in the source image
+            float gx = (x + 0.5f) * image_width / new_width  - 0.5f;
+            int x0 = floor(gx);
+            column_dx[x - chunk_start] = gx - x0;
+
+            // clamp coordinates to image boundaries
+            column_x0[x - chunk_start] = clamp(x0, 0, image_width-1) * bytes;
+            column_x1[x - chunk_start] = clamp(x0 + 1, 0, image_width-1) * bytes;
+        }
+
+        for (int y = y_start; y < y_end; y++) {
+            float gy = (y + 0.5f) * image_height / new_height - 0.5f;
+            int y0 = floor(gy);
+            float dy = gy - y0;
+            const uint8_t* top_row = pixels->data + clamp(y0, 0, image_height-1) * pixels->stride;
+            const uint8_t* bottom_row = pixels->data + clamp(y0 + 1, 0, image_height-1) * pixels->stride;
+
+            for (int x = chunk_start; x < chunk_end; x++) {
+                int x0 = column_x0[x - chunk_start];
+                int x1 = column_x1[x - chunk_start];
+                float dx = column_dx[x - chunk_start];
+
+                // sample the four neighboring pixels
+                const uint8_t* top_left = top_row + x0;
+                uint8_t top_left_r = top_left[r_at];
+                uint8_t top_left_g = top_left[g_at];
+                uint8_t top_left_b = top_left[b_at];
+                uint8_t top_left_a = 255;
+                if (a_at >= 0) top_left_a = top_left[a_at];
+
+                const uint8_t* top_right = top_row + x1;
+                uint8_t top_right_r = top_right[r_at];
+                uint8_t top_right_g = top_right[g_at];
+                uint8_t top_right_b = top_right[b_at];
+                uint8_t top_right_a = 255;
+                if (a_at >= 0) top_right_a = top_right[a_at];
+
+                const uint8_t* bottom_left = bottom_row + x0;
+                uint8_t bottom_left_r = bottom_left[r_at];
+                uint8_t bottom_left_g = bottom_left[g_at];
+                uint8_t bottom_left_b = bottom_left[b_at];
+                uint8_t bottom_left_a = 255;
+                if (a_at >= 0) bottom_left_a = bottom_left[a_at];
+
+                const uint8_t* bottom_right = bottom_row + x1;
+                uint8_t bottom_right_r = bottom_right[r_at];
+                uint8_t bottom_right_g = bottom_right[g_at];
+                uint8_t bottom_right_b = bottom_right[b_at];
+                uint8_t bottom_right_a = 255;
+                if (a_at >= 0) bottom_right_a = bottom_right[a_at];
+
+                // interpolate horizontally then vertically
+                uint8_t top_r;
+                uint8_t top_g;
+                uint8_t top_b;
+                uint8_t top_a = 255;
+                lerp(
+                    &top_r,
+                    &top_g,
+                    &top_b,
+                    &top_a,
+                    top_left_r,
+                    top_left_g,
+                    top_left_b,
+                    top_left_a,
+                    top_right_r,
+                    top_right_g,
+                    top_right_b,
+                    top_right_a,
+                    dx
+                );
+                uint8_t bottom_r;
+                uint8_t bottom_g;
+                uint8_t bottom_b;
+                uint8_t bottom_a = 255;
+                lerp(
+                    &bottom_r,
+                    &bottom_g,
+                    &bottom_b,
+                    &bottom_a,
+                    bottom_left_r,
+                    bottom_left_g,
+                    bottom_left_b,
+                    bottom_left_a,
+                    bottom_right_r,
+                    bottom_right_g,
+                    bottom_right_b,
+                    bottom_right_a,
+                    dx
+                );
+                uint8_t r;
+                uint8_t g;
+                uint8_t b;
+                uint8_t a = 255;
+                lerp(
+                    &r,
+                    &g,
+                    &b,
+                    &a,
+                    top_r,
+                    top_g,
+                    top_b,
+                    top_a,
+                    bottom_r,
+                    bottom_g,
+                    bottom_b,
+                    bottom_a,
+                    dy
+                );
+                int index = ((y - y_start) * new_width + x) * 4;
+                rows[index] = r;
+                rows[index+1] = g;
+                rows[index+2] = b;
+                rows[index+3] = a;
+            }
+        }
+    }
+}
+
+/*
+    Scales rows [y_start, y_end) of a new_width x new_height image (RGBA) from pixels with
+    bilinear interpolation. The rows are written to rows, starting with row y_start.
+*/
+void scale_pixels_bilinear_rows(
+    const TImagePixels* pixels,
+    uint8_t* rows,
+    int new_width,
+    int new_height,
+    int y_start,
+    int y_end
+) {
+    scale_pixels_bilinear_area(pixels, rows, new_width, new_height, 0, new_width, y_start, y_end);
+}
+
+/*
+    Same as scale_pixels_bilinear_rows for an image straight from stb_image with channels channels.
+*/
+void scale_image_bilinear_rows(
+    uint8_t* image,
+    int image_width,
+    int image_height,
+    int channels,
+    uint8_t* rows,
+    int new_width,
+    int new_height,
+    int y_start,
+    int y_end
+) {
+    TImagePixels pixels = image_pixels(image, image_width, image_height, (TImagePixelFormat)channels, 0);
+    scale_pixels_bilinear_rows(&pixels, rows, new_width, new_height, y_start, y_end);
+}
+
+/*
+    Scales image into new_image (RGBA) with bilinear interpolation.
+*/
+void scale_image_bilinear(
+    uint8_t* image,
+    int image_width,
+    int image_height,
+    int channels,
+    uint8_t* new_image,
+    int new_width,
+    int new_height
+) {
+    scale_image_bilinear_rows(image, image_width, image_height, channels, new_image, new_width, new_height, 0, new_height);
+}
+
+
+/*
+    Splits the cell's pixels by which color they're closer to, as masks in the glyph table
+    format: first_variation has the pixels closest to avg_1 (r, g, b, a) set and
+    second_variation the ones closest to avg_2.
+*/
+void cell_variations(
+    uint8_t* new_image,
+    int image_width_cells,
+    int c_x,
+    int c_y,
+    const int* avg_1,
+    const int* avg_2,
+    uint64_t* first_variation,
+    uint64_t* second_variation
+) {
+    first_variation[0] = 0; // avg_1 is set or is text
+    first_variation[1] = 0;
+    second_variation[0] = 0; // avg_2 is set or is text
+    second_variation[1] = 0;
+    for (int x = 0; x < CURSOR_WIDTH; x++) {
+        for (int y = 0; y < CURSOR_HEIGHT; y++) {
+
+            int i = get_image_index(c_x, c_y, x, y, image_width_cells, CURSOR_WIDTH, CURSOR_HEIGHT);
+            uint8_t r = new_image[i];
+            uint8_t g = new_image[i+1];
+            uint8_t b = new_image[i+2];
+            uint8_t a = new_image[i+3];
+            int dist_1 = dist(avg_1[0], avg_1[1], avg_1[2], avg_1[3], r, g, b, a);
+            int dist_2 = dist(avg_2[0], avg_2[1], avg_2[2], avg_2[3], r, g, b, a);
+
+            int index = x + y * CURSOR_WIDTH;
+            int is_second_uint = 0;
+            if (index > 64) {
+                is_second_uint = 1;
+                index %= 64;
+            }
+            
+            if (dist_1 < dist_2) {
+                set_bit(
+                    is_second_uint? &first_variation[1] : &first_variation[0],
+                    63-index
+                );
+            }
+            else {
+                set_bit(
+                    is_second_uint? &second_variation[1] : &second_variation[0],
+                    63-index
+                );
+            }
+        }
+    }
+}
+
+/*
+    Picks the two colors and the character for the cell at c_x, c_y of the scaled image.
+*/
+void convert_cell(
+    TImageConverter* converter,
+    uint8_t* new_image,
+    int image_width_cells,
+    int c_x,
+    int c_y,
+    TImagePackedCell* cell
+) {
+    // kmeans determine color pair for cells
+    int avg_1_r, avg_1_g, avg_1_b, avg_1_a;
+    int avg_2_r, avg_2_g, avg_2_b, avg_2_a;
+    kmeans_for_colors(
+        new_image,
+        c_x,
+        c_y,
+        image_width_cells,
+        CURSOR_WIDTH,
+        CURSOR_HEIGHT,
+        converter->kmeans_iterations,
+        &avg_1_r, 
+        &avg_1_g, 
+        &avg_1_b, 
+        &avg_1_a,
+        &avg_2_r, 
+        &avg_2_g, 
+        &avg_2_b, 
+        &avg_2_a
+    );
+
+    // determine character that matches the pixels the best
+    int avg_1[4] = {avg_1_r, avg_1_g, avg_1_b, avg_1_a};
+    int avg_2[4] = {avg_2_r, avg_2_g, avg_2_b, avg_2_a};
+    uint64_t first_variation[2];
+    uint64_t second_variation[2];
+    cell_variations(new_image, image_width_cells, c_x, c_y, avg_1, avg_2, first_variation, second_variation);
+
+    int is_first_best;
+    int best_glyph = converter->match_glyph(first_variation, second_variation, &is_first_best);
+
+
+    cell->glyph = best_glyph;
+    cell->unused = 0;
+    if (is_first_best) {
+        cell->text_color.r = avg_1_r;
+        cell->text_color.g = avg_1_g;
+        cell->text_color.b = avg_1_b;
+        cell->background_color.r = avg_2_r;
+        cell->background_color.g = avg_2_g;
+        cell->background_color.b = avg_2_b;
+    }
+    else {
+        cell->text_color.r = avg_2_r;
+        cell->text_color.g = avg_2_g;
+        cell->text_color.b = avg_2_b;
+        cell->background_color.r = avg_1_r;
+        cell->background_color.g = avg_1_g;
+        cell->background_color.b = avg_1_b;
+    }
+}
+
+
+// work is handed to the pool in bands of scaled rows and tiles of cells
+#define SCALE_BAND_ROWS 16
+#define TILE_WIDTH_CELLS 16
+#define TILE_HEIGHT_CELLS 2
+
+typedef struct {
+    TImageConverter* converter;
+    const TImagePixels* pixels;
+    int new_width;
+    int new_height;
+    int image_width_cells;
+    int image_height_cells;
+    int tiles_across;
+    int display_width;
+    TImagePackedCell* cells;
+    int cell_row; // when converting one row at a time
+
+    // cells [cell_x_start, cell_x_end) x [cell_y_start, cell_y_end) are converted, all of them unless only part of the image changed
+    int cell_x_start;
+    int cell_x_end;
+    int cell_y_start;
+    int cell_y_end;
+} TImageConversion;
+
+// scales a band of the pixels under the cells being converted
+static void scale_band_task(void* arg, int band) {
+    TImageConversion* conversion = arg;
+    int y_start = conversion->cell_y_start * CURSOR_HEIGHT + band * SCALE_BAND_ROWS;
+    int y_end = y_start + SCALE_BAND_ROWS;
+    if (y_end > conversion->cell_y_end * CURSOR_HEIGHT) y_end = conversion->cell_y_end * CURSOR_HEIGHT;
+    scale_pixels_bilinear_area(
+        conversion->pixels,
+        conversion->converter->new_image + (size_t)y_start * conversion->new_width * 4,
+        conversion->new_width,
+        conversion->new_height,
+        conversion->cell_x_start * CURSOR_WIDTH,
+        conversion->cell_x_end * CURSOR_WIDTH,
+        y_start,
+        y_end
+    );
+}
+
+static void convert_tile_task(void* arg, int tile) {
+    TImageConversion* conversion = arg;
+    TImageConverter* converter = conversion->converter;
+    int c_x_start = conversion->cell_x_start + tile % conversion->tiles_across * TILE_WIDTH_CELLS;
+    int c_y_start = conversion->cell_y_start + tile / conversion->tiles_across * TILE_HEIGHT_CELLS;
+    for (int c_y = c_y_start; c_y < c_y_start + TILE_HEIGHT_CELLS && c_y < conversion->cell_y_end; c_y++) {
+        for (int c_x = c_x_start; c_x < c_x_start + TILE_WIDTH_CELLS && c_x < conversion->cell_x_end; c_x++) {
+            TImagePackedCell* cell = &conversion->cells[c_x + c_y * conversion->display_width];
+            convert_cell(converter, converter->new_image, conversion->image_width_cells, c_x, c_y, cell);
+        }
+    }
+}
+
+// scales one pixel row of the current cell row into the converter's row of pixels
+static void scale_row_task(void* arg, int y) {
+    TImageConversion* conversion = arg;
+    int new_y = conversion->cell_row * CURSOR_HEIGHT + y;
+    scale_pixels_bilinear_rows(
+        conversion->pixels,
+        conversion->converter->new_image + (size_t)y * conversion->new_width * 4,
+        conversion->new_width,
+        conversion->new_height,
+        new_y,
+        new_y + 1
+    );
+}
+
+// converts TILE_WIDTH_CELLS cells of the current cell row, the row's pixels start at row 0 of new_image
+static void convert_row_tile_task(void* arg, int tile) {
+    TImageConversion* conversion = arg;
+    TImageConverter* converter = conversion->converter;
+    for (int c_x = tile * TILE_WIDTH_CELLS; c_x < (tile + 1) * TILE_WIDTH_CELLS && c_x < conversion->image_width_cells; c_x++) {
+        convert_cell(converter, converter->new_image, conversion->image_width_cells, c_x, 0, &conversion->cells[c_x]);
+    }
+}
+
+// the pool matching converter->thread_count, or NULL to work on the calling thread
+static TImageThreadPool* converter_pool(TImageConverter* converter) {
+    int thread_count = converter->thread_count;
+    if (thread_count <= 0) {
+        thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (thread_count <= 1) {
+        return NULL;
+    }
+
+    if (converter->pool != NULL && converter->pool->thread_count != thread_count) {
+        free_thread_pool(converter->pool);
+        converter->pool = NULL;
+    }
+    if (converter->pool == NULL) {
+        converter->pool = new_thread_pool(thread_count);
+    }
+    return converter->pool;
+}
+
+// SCALE the pixels under the conversion's cells then DETERMINE their characters and colors
+static void convert_cell_area(TImageThreadPool* pool, TImageConversion* conversion) {
+    int rows = (conversion->cell_y_end - conversion->cell_y_start) * CURSOR_HEIGHT;
+    pool_run(pool, (rows + SCALE_BAND_ROWS - 1) / SCALE_BAND_ROWS, scale_band_task, conversion);
+   //  stbi_write_png("test/resized.png", conversion->new_width, conversion->new_height, 4, conversion->converter->new_image, conversion->new_width * 4);
+
+    int cells_across = conversion->cell_x_end - conversion->cell_x_start;
+    int cells_down = conversion->cell_y_end - conversion->cell_y_start;
+    conversion->tiles_across = (cells_across + TILE_WIDTH_CELLS - 1) / TILE_WIDTH_CELLS;
+    int tiles_down = (cells_down + TILE_HEIGHT_CELLS - 1) / TILE_HEIGHT_CELLS;
+    pool_run(pool, conversion->tiles_across * tiles_down, convert_tile_task, conversion);
+}
+
+// EXIF thumbnails
+#define EXIF_SEARCH_BYTES (256 * 1024) // the EXIF data is in the first segments, before the image data
+#define THUMBNAIL_MAX_ASPECT_ERROR 0.02 // thumbnails padded to a different shape are skipped
+
+static uint32_t read_exif_int(const uint8_t* bytes, int size, int is_little_endian) {
+    uint32_t value = 0;
+    for (int i = 0; i < size; ++i) {
+        int shift = is_little_endian? i * 8 : (size - 1 - i) * 8;
+        value |= (uint32_t)bytes[i] << shift;
+    }
+    return value;
+}
+
+/*
+    Finds the thumbnail jpeg in the EXIF data (the APP1 segment) of the jpeg in data, and the size of
+    the main image from its frame header. Returns 1 and points thumbnail into data if there is one.
+*/
+int find_exif_thumbnail(
+    const uint8_t* data,
+    size_t len,
+    const uint8_t** thumbnail,
+    size_t* thumbnail_length,
+    int* image_width,
+    int* image_height
+) {
+    *thumbnail = NULL;
+    *image_width = 0;
+    *image_height = 0;
+    if (len < 4 || data[0] != 0xFF || data[1] != 0xD8) return 0;
+
+    // walk the segments up to the frame header
+    size_t pos = 2;
+    while (pos + 4 <= len && *image_width == 0) {
+        if (data[pos] != 0xFF) return 0;
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            ++pos; // padding
+            continue;
+        }
+        if (marker == 0xDA || marker == 0xD9) break; // image data without a frame header
+        size_t segment_length = (data[pos + 2] << 8) | data[pos + 3];
+        const uint8_t* segment = data + pos + 4;
+        if (segment_length < 2 || pos + 2 + segment_length > len) break;
+        segment_length -= 2;
+
+        int is_frame_header = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (is_frame_header && segment_length >= 5) {
+            *image_height = (segment[1] << 8) | segment[2];
+            *image_width = (segment[3] << 8) | segment[4];
+        }
+        if (marker == 0xE1 && segment_length > 14 && memcmp(segment, "Exif\0\0", 6) == 0) {
+
+            // a tiff header, then IFD0 (the main image) whose link points to IFD1 (the thumbnail)
+            const uint8_t* tiff = segment + 6;
+            size_t tiff_length = segment_length - 6;
+            int is_little_endian = tiff[0] == 'I';
+            uint32_t ifd = read_exif_int(tiff + 4, 4, is_little_endian);
+            if (read_exif_int(tiff + 2, 2, is_little_endian) == 42 && ifd <= tiff_length - 2) {
+                uint32_t link = ifd + 2 + read_exif_int(tiff + ifd, 2, is_little_endian) * 12;
+                ifd = link <= tiff_length - 4? read_exif_int(tiff + link, 4, is_little_endian) : 0;
+            }
+            else {
+                ifd = 0;
+            }
+
+            uint32_t offset = 0;
+            uint32_t length = 0;
+            if (ifd != 0 && ifd <= tiff_length - 2) {
+                uint32_t entries = read_exif_int(tiff + ifd, 2, is_little_endian);
+                for (uint32_t i = 0; i < entries && ifd + 2 + (i + 1) * 12 <= tiff_length; ++i) {
+                    const uint8_t* entry = tiff + ifd + 2 + i * 12;
+                    uint32_t tag = read_exif_int(entry, 2, is_little_endian);
+                    uint32_t value = read_exif_int(entry + 8, 4, is_little_endian);
+                    if (tag == 0x0201) offset = value; // JPEGInterchangeFormat
+                    if (tag == 0x0202) length = value; // JPEGInterchangeFormatLength
+                }
+            }
+            if (length > 2 && offset < tiff_length && length <= tiff_length - offset && tiff[offset] == 0xFF && tiff[offset + 1] == 0xD8) {
+                *thumbnail = tiff + offset;
+                *thumbnail_length = length;
+            }
+        }
+        pos += 4 + segment_length;
+    }
+
+    return *thumbnail != NULL && *image_width > 0 && *image_height > 0;
+}
+
+/*
+    Decodes the EXIF thumbnail of the jpeg in data if it has one that's at least fit_width wide or
+    fit_height tall (so it's still enough pixels once fit in that box) and the same shape as the image.
+    Returns NULL otherwise.
+*/
+uint8_t* load_exif_thumbnail(
+    const uint8_t* data,
+    size_t len,
+    int fit_width,
+    int fit_height,
+    int* image_width,
+    int* image_height,
+    int* channels
+) {
+    if (len > EXIF_SEARCH_BYTES) len = EXIF_SEARCH_BYTES;
+
+    const uint8_t* thumbnail;
+    size_t thumbnail_length;
+    int width, height, thumbnail_width, thumbnail_height, thumbnail_channels;
+    if (!find_exif_thumbnail(data, len, &thumbnail, &thumbnail_length, &width, &height)) return NULL;
+    if (!stbi_info_from_memory(thumbnail, thumbnail_length, &thumbnail_width, &thumbnail_height, &thumbnail_channels)) return NULL;
+    if (thumbnail_width < fit_width && thumbnail_height < fit_height) return NULL;
+
+    double aspect = (double)width / height;
+    double thumbnail_aspect = (double)thumbnail_width / thumbnail_height;
+    if (fabs(thumbnail_aspect - aspect) > aspect * THUMBNAIL_MAX_ASPECT_ERROR) return NULL;
+
+    return stbi_load_from_memory(thumbnail, thumbnail_length, image_width, image_height, channels, 0);
+}
+
+
+/*
+    The bytes of an image file. Files are mapped into memory (so the decoder reads the page
+    cache directly instead of through stdio's buffers), stdin and pipes are read into one
+    buffer that grows as needed. A path of "-" reads stdin.
+
+    Used like so:
+    ```
+    TImageInput* input = open_image_input("test/wizards.jpg");
+    if (input == NULL) {
+        perror("open");
+    }
+    uint8_t* image = stbi_load_from_memory(input->data, input->len, &width, &height, &channels, 0);
+    close_image_input(input);
+    ```
+*/
+typedef struct {
+    uint8_t* data;
+    size_t len;
+    size_t capacity; // when read into a buffer
+    int is_mapped;
+} TImageInput;
+
+#define INPUT_READ_CHUNK (64 * 1024)
+
+// blocks until a nonblocking fd that returned EAGAIN is ready for events (POLLIN or POLLOUT) again
+static void wait_for_fd(int fd, short events) {
+    struct pollfd poll_fd = {fd, events, 0};
+    poll(&poll_fd, 1, -1);
+}
+
+static int read_image_input(TImageInput* input, int fd) {
+    for (;;) {
+        if (input->capacity - input->len < INPUT_READ_CHUNK) {
+            size_t capacity = input->capacity * 2;
+            if (capacity < INPUT_READ_CHUNK * 4) capacity = INPUT_READ_CHUNK * 4;
+            input->data = grow_buffer(input->data, &input->capacity, capacity);
+        }
+        ssize_t result = read(fd, input->data + input->len, input->capacity - input->len);
+        if (result < 0) {
+            if (errno == EAGAIN) {
+                wait_for_fd(fd, POLLIN);
+                continue;
+            }
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (result == 0) return 0;
+        input->len += result;
+    }
+}
+
+/**
+ * Opens an image file (or stdin for "-") as bytes in memory. Returns NULL if it can't be read (errno is set).
+ * Close it with close_image_input.
+ */
+TImageInput* open_image_input(char* path) {
+    TImageInput* input = calloc(1, sizeof(TImageInput));
+    if (input == NULL) {
+        converter_mem_error_exit_failing();
+    }
+
+    int is_stdin = strcmp(path, "-") == 0;
+    int fd = is_stdin? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) {
+        free(input);
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, info.st_size, MADV_SEQUENTIAL);
+            input->data = data;
+            input->len = info.st_size;
+            input->is_mapped = 1;
+        }
+    }
+
+    // pipes, stdin, or anything that can't be mapped
+    int error = 0;
+    if (!input->is_mapped && read_image_input(input, fd) != 0) {
+        error = errno;
+    }
+    if (!is_stdin) {
+        close(fd);
+    }
+    if (error != 0) {
+        free(input->data);
+        free(input);
+        errno = error;
+        return NULL;
+    }
+    return input;
+}
+
+void close_image_input(TImageInput* input) {
+    if (input->is_mapped) {
+        munmap(input->data, input->len);
+    }
+    else {
+        free(input->data);
+    }
+    free(input);
+}
+
+
+/*
+    Decodes an image file's bytes, returns NULL if it can't be decoded (stbi_failure_reason says why).
+
+    Jpegs are decoded straight at 1/2, 1/4 or 1/8 of their size if converter->is_jpeg_downscaled
+    is set and that's still at least as many pixels as the cells show (scaled_image_size would
+    scale it down further anyway). With converter->is_thumbnail_used the jpeg's EXIF thumbnail
+    is decoded instead when it's that big too. image_width and image_height are the decoded size.
+*/
+uint8_t* decode_image(
+    TImageConverter* converter,
+    const uint8_t* data,
+    size_t len,
+    int display_width,
+    int display_height,
+    int* image_width,
+    int* image_height,
+    int* channels
+) {
+    if (len > INT_MAX) {
+        stbi__err("too large", "Image file too large");
+        return NULL;
+    }
+
+    uint8_t* image = NULL;
+    int fit_width = display_width * CURSOR_WIDTH;
+    int fit_height = display_height * CURSOR_HEIGHT;
+    if (converter->is_thumbnail_used) {
+        image = load_exif_thumbnail(data, len, fit_width, fit_height, image_width, image_height, channels);
+    }
+    if (image == NULL && converter->is_jpeg_downscaled) {
+        image = stbi_load_from_memory_to_fit(data, len, image_width, image_height, channels, 0, fit_width, fit_height);
+    }
+    else if (image == NULL) {
+        image = stbi_load_from_memory(data, len, image_width, image_height, channels, 0);
+    }
+    return image;
+}
+
+/*
+    An image read and decoded once, so it can be converted and described without loading it again.
+
+    pixels are what was decoded, which can be smaller than the image itself (see decode_image).
+    width, height and channels are the image's own from its header and file_size is the number
+    of bytes read.
+
+    Used like so:
+    ```
+    TImageLoaded* loaded = new_loaded_image(converter, path, display_width, display_height);
+    convert_pixels_to_packed_cells(converter, &loaded->pixels, display_width, display_height, NULL);
+    printf("%d x %d\n", loaded->width, loaded->height);
+    free_loaded_image(loaded);
+    ```
+*/
+typedef struct {
+    uint8_t* data;
+    TImagePixels pixels;
+    int width;
+    int height;
+    int channels;
+    size_t file_size;
+} TImageLoaded;
+
+/*
+    Reads and decodes the image at path (see open_image_input and decode_image). Returns NULL if it
+    can't be loaded and sets reason to why.
+*/
+TImageLoaded* try_load_image(TImageConverter* converter, char* path, int display_width, int display_height, const char** reason) {
+    TImageInput* input = open_image_input(path);
+    if (input == NULL) {
+        *reason = strerror(errno);
+        return NULL;
+    }
+
+    TImageLoaded* loaded = malloc(sizeof(TImageLoaded));
+    if (loaded == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    int decoded_width, decoded_height, channels;
+    loaded->data = decode_image(converter, input->data, input->len, display_width, display_height, &decoded_width, &decoded_height, &channels);
+    if (!loaded->data) {
+        *reason = stbi_failure_reason();
+        close_image_input(input);
+        free(loaded);
+        return NULL;
+    }
+    loaded->pixels = image_pixels(loaded->data, decoded_width, decoded_height, (TImagePixelFormat)channels, 0);
+    loaded->file_size = input->len;
+
+    // the header has the full size, the pixels might be a downscaled jpeg or a thumbnail
+    if (!stbi_info_from_memory(input->data, (int)input->len, &loaded->width, &loaded->height, &loaded->channels)) {
+        loaded->width = decoded_width;
+        loaded->height = decoded_height;
+        loaded->channels = channels;
+    }
+    close_image_input(input);
+    return loaded;
+}
+
+/*
+    Same as try_load_image but exits if the image can't be loaded.
+*/
+TImageLoaded* new_loaded_image(TImageConverter* converter, char* path, int display_width, int display_height) {
+    const char* reason;
+    TImageLoaded* loaded = try_load_image(converter, path, display_width, display_height, &reason);
+    if (loaded == NULL) {
+        printf("Failed to load image: %s\n", reason);
+        exit(-1);
+    }
+    return loaded;
+}
+
+void free_loaded_image(TImageLoaded* loaded) {
+    free(loaded->data);
+    free(loaded);
+}
+
+/*
+    Same as new_loaded_image but just returns the decoded pixels, free them with free.
+*/
+uint8_t* load_image(
+    TImageConverter* converter,
+    char* path,
+    int display_width,
+    int display_height,
+    int* image_width,
+    int* image_height,
+    int* channels
+) {
+    TImageLoaded* loaded = new_loaded_image(converter, path, display_width, display_height);
+    uint8_t* image = loaded->data;
+    *image_width = loaded->pixels.width;
+    *image_height = loaded->pixels.height;
+    *channels = pixel_format_bytes(loaded->pixels.format);
+    free(loaded);
+    return image;
+}
+
+/*
+    The utf8 character for a packed cell, a space for cells outside the image.
+*/
+const char* packed_cell_unicode(TImagePackedCell cell) {
+    if (cell.glyph == EMPTY_CELL) return " ";
+    return GLYPH_CHARACTERS[cell.glyph];
+}
+
+/**
+ * Converts pixels already in memory into display_width x display_height packed cells, one flat array in
+ * the same order as convert_image_to_ansii_cells (a newline every display_width cells). The pixels are
+ * read where they are, they're never copied or changed.
+ * 
+ * The cells are written to out if you pass one (it needs display_width * display_height cells), otherwise
+ * to a buffer the converter owns which stays valid until the next conversion. Returns the cells.
+ */
+TImagePackedCell* convert_pixels_to_packed_cells(
+    TImageConverter* converter,
+    const TImagePixels* pixels,
+    int display_width,
+    int display_height,
+    TImagePackedCell* out
+) {
+
+    size_t cell_count = (size_t)display_width * display_height;
+    if (out == NULL) {
+        converter->packed_cells = grow_buffer(converter->packed_cells, &converter->packed_cells_capacity, cell_count * sizeof(TImagePackedCell));
+        out = converter->packed_cells;
+    }
+
+    TImageThreadPool* pool = converter_pool(converter);
+    TImageConversion conversion;
+    conversion.converter = converter;
+    conversion.pixels = pixels;
+    conversion.display_width = display_width;
+    conversion.cells = out;
+    scaled_image_size(pixels->width, pixels->height, display_width, display_height, &conversion.new_width, &conversion.new_height);
+    size_t new_image_length = (size_t)conversion.new_height * conversion.new_width * 4;
+    converter->new_image = grow_buffer(converter->new_image, &converter->new_image_capacity, new_image_length);
+    conversion.image_width_cells = floor((double)conversion.new_width / (double)CURSOR_WIDTH);
+    conversion.image_height_cells = floor((double)conversion.new_height / (double)CURSOR_HEIGHT);
+
+    for (int c_y = 0; c_y < display_height; c_y++) {
+        int c_x = c_y < conversion.image_height_cells? conversion.image_width_cells : 0;
+        for (; c_x < display_width; c_x++) {
+            TImagePackedCell empty = {EMPTY_CELL, {0, 0, 0}, {0, 0, 0}, 0};
+            out[c_x + c_y * display_width] = empty;
+        }
+    }
+    conversion.cell_x_start = 0;
+    conversion.cell_x_end = conversion.image_width_cells;
+    conversion.cell_y_start = 0;
+    conversion.cell_y_end = conversion.image_height_cells;
+    convert_cell_area(pool, &conversion);
+
+    return out;
+}
+
+/*
+    Finds the smallest box holding every pixel that differs between pixels and previous (which are the same
+    size and format), returns 0 if none do.
+*/
+static int changed_pixel_box(const TImagePixels* pixels, const TImagePixels* previous, int* x_start, int* x_end, int* y_start, int* y_end) {
+    int bytes = pixel_format_bytes(pixels->format);
+    size_t row_length = (size_t)pixels->width * bytes;
+    *x_start = pixels->width;
+    *x_end = 0;
+    *y_start = pixels->height;
+    *y_end = 0;
+    for (int y = 0; y < pixels->height; y++) {
+        const uint8_t* row = pixels->data + y * pixels->stride;
+        const uint8_t* previous_row = previous->data + y * previous->stride;
+        if (memcmp(row, previous_row, row_length) == 0) continue;
+
+        int left = 0;
+        while (memcmp(row + left * bytes, previous_row + left * bytes, bytes) == 0) left++;
+        int right = pixels->width - 1;
+        while (memcmp(row + right * bytes, previous_row + right * bytes, bytes) == 0) right--;
+        if (left < *x_start) *x_start = left;
+        if (right + 1 > *x_end) *x_end = right + 1;
+        if (y < *y_start) *y_start = y;
+        *y_end = y + 1;
+    }
+    return *y_end > 0;
+}
+
+/*
+    The cells whose scaled pixels read from source pixels [start, end) (along one side), bilinear
+    interpolation reads the two source pixels around each scaled pixel. One scaled pixel of slack
+    is added on each side for rounding.
+*/
+static void cells_over_pixels(int start, int end, int image_length, int new_length, int cell_length, int cell_count, int* cell_start, int* cell_end) {
+    double scale = (double)new_length / image_length;
+    int new_start = (int)floor((start - 0.5) * scale - 0.5) - 1;
+    int new_end = (int)ceil((end + 0.5) * scale - 0.5) + 1;
+    *cell_start = new_start < 0? 0 : new_start / cell_length;
+    *cell_end = (new_end + cell_length - 1) / cell_length;
+    if (*cell_end > cell_count) *cell_end = cell_count;
+}
+
+/**
+ * Converts the next frame of an animation. cells must hold what convert_pixels_to_packed_cells made from previous
+ * (the frame before, same size and format) for the same display size, only the cells over pixels that changed are
+ * converted again so the cells end up the same as converting pixels from scratch.
+ * 
+ * Returns the number of cells converted again, 0 if nothing changed.
+ */
+size_t convert_pixels_changes(
+    TImageConverter* converter,
+    const TImagePixels* pixels,
+    const TImagePixels* previous,
+    int display_width,
+    int display_height,
+    TImagePackedCell* cells
+) {
+    int x_start, x_end, y_start, y_end;
+    if (!changed_pixel_box(pixels, previous, &x_start, &x_end, &y_start, &y_end)) {
+        return 0;
+    }
+
+    TImageConversion conversion;
+    conversion.converter = converter;
+    conversion.pixels = pixels;
+    conversion.display_width = display_width;
+    conversion.cells = cells;
+    scaled_image_size(pixels->width, pixels->height, display_width, display_height, &conversion.new_width, &conversion.new_height);
+    size_t new_image_length = (size_t)conversion.new_height * conversion.new_width * 4;
+    converter->new_image = grow_buffer(converter->new_image, &converter->new_image_capacity, new_image_length);
+    conversion.image_width_cells = floor((double)conversion.new_width / (double)CURSOR_WIDTH);
+    conversion.image_height_cells = floor((double)conversion.new_height / (double)CURSOR_HEIGHT);
+
+    cells_over_pixels(x_start, x_end, pixels->width, conversion.new_width, CURSOR_WIDTH, conversion.image_width_cells, &conversion.cell_x_start, &conversion.cell_x_end);
+    cells_over_pixels(y_start, y_end, pixels->height, conversion.new_height, CURSOR_HEIGHT, conversion.image_height_cells, &conversion.cell_y_start, &conversion.cell_y_end);
+    if (conversion.cell_x_start >= conversion.cell_x_end || conversion.cell_y_start >= conversion.cell_y_end) {
+        return 0;
+    }
+    convert_cell_area(converter_pool(converter), &conversion);
+
+    return (size_t)(conversion.cell_x_end - conversion.cell_x_start) * (conversion.cell_y_end - conversion.cell_y_start);
+}
+
+/**
+ * Converts an image file into display_width x display_height packed cells, one flat array in the same
+ * order as convert_image_to_ansii_cells (a newline every display_width cells).
+ * 
+ * The cells are written to out if you pass one (it needs display_width * display_height cells), otherwise
+ * to a buffer the converter owns which stays valid until the next conversion. Returns the cells.
+ */
+TImagePackedCell* convert_image_to_packed_cells(
+    TImageConverter* converter,
+    char* path,
+    int display_width,
+    int display_height,
+    TImagePackedCell* out
+) {
+
+    // LOAD image
+    int image_width, image_height, channels;
+    uint8_t *image = load_image(converter, path, display_width, display_height, &image_width, &image_height, &channels);
+    TImagePixels pixels = image_pixels(image, image_width, image_height, (TImagePixelFormat)channels, 0);
+
+    out = convert_pixels_to_packed_cells(converter, &pixels, display_width, display_height, out);
+    free(image);
+    return out;
+}
+
+/*
+    Called with each row of cells as soon as it's converted, rows come in order from 0 to
+    display_height - 1. cells (display_width of them) is only valid during the call.
+*/
+typedef void (*TImageRowHandler)(void* arg, int row, TImagePackedCell* cells, int display_width);
+
+/**
+ * Converts pixels already in memory one row of cells at a time, handing each row to on_row as soon as
+ * it's done instead of waiting for the whole image. The cells are the same as convert_pixels_to_packed_cells.
+ * 
+ * Only one row of scaled pixels and one row of cells are kept at a time, so the memory used grows
+ * with display_width and not with the number of rows.
+ */
+void convert_pixels_rows(
+    TImageConverter* converter,
+    const TImagePixels* pixels,
+    int display_width,
+    int display_height,
+    TImageRowHandler on_row,
+    void* arg
+) {
+
+    TImageThreadPool* pool = converter_pool(converter);
+    TImageConversion conversion;
+    conversion.converter = converter;
+    conversion.pixels = pixels;
+    conversion.display_width = display_width;
+    scaled_image_size(pixels->width, pixels->height, display_width, display_height, &conversion.new_width, &conversion.new_height);
+    conversion.image_width_cells = floor((double)conversion.new_width / (double)CURSOR_WIDTH);
+    conversion.image_height_cells = floor((double)conversion.new_height / (double)CURSOR_HEIGHT);
+    conversion.tiles_across = (conversion.image_width_cells + TILE_WIDTH_CELLS - 1) / TILE_WIDTH_CELLS;
+
+    size_t row_image_length = (size_t)conversion.new_width * CURSOR_HEIGHT * 4;
+    converter->new_image = grow_buffer(converter->new_image, &converter->new_image_capacity, row_image_length);
+    converter->packed_cells = grow_buffer(converter->packed_cells, &converter->packed_cells_capacity, display_width * sizeof(TImagePackedCell));
+    conversion.cells = converter->packed_cells;
+
+    TImagePackedCell empty = {EMPTY_CELL, {0, 0, 0}, {0, 0, 0}, 0};
+    for (int c_y = 0; c_y < display_height; c_y++) {
+        int c_x = 0;
+        if (c_y < conversion.image_height_cells) {
+            // SCALE just the pixels under this row, then DETERMINE its cells
+            conversion.cell_row = c_y;
+            pool_run(pool, CURSOR_HEIGHT, scale_row_task, &conversion);
+            pool_run(pool, conversion.tiles_across, convert_row_tile_task, &conversion);
+            c_x = conversion.image_width_cells;
+        }
+        for (; c_x < display_width; c_x++) {
+            conversion.cells[c_x] = empty;
+        }
+        on_row(arg, c_y, conversion.cells, display_width);
+    }
+}
+
+/**
+ * Converts an image file one row of cells at a time, handing each row to on_row as soon as it's done
+ * instead of waiting for the whole image. The cells are the same as convert_image_to_packed_cells.
+ * 
+ * Only one row of scaled pixels and one row of cells are kept at a time, so besides the decoded image
+ * the memory used grows with display_width and not with the number of rows.
+ */
+void convert_image_rows(
+    TImageConverter* converter,
+    char* path,
+    int display_width,
+    int display_height,
+    TImageRowHandler on_row,
+    void* arg
+) {
+
+    // LOAD image
+    int image_width, image_height, channels;
+    uint8_t *image = load_image(converter, path, display_width, display_height, &image_width, &image_height, &channels);
+    TImagePixels pixels = image_pixels(image, image_width, image_height, (TImagePixelFormat)channels, 0);
+
+    convert_pixels_rows(converter, &pixels, display_width, display_height, on_row, arg);
+    free(image);
+}
+
+/**
+ * Same as convert_image_to_ansii_cells but reuses the converter's buffers.
+ * 
+ * The returned cells (and their unicode strings) belong to the converter and stay valid until
+ * the next conversion or until the converter is freed. Don't call free_image_cells on them.
+ */
+TImageCell** convert_image_with_converter(TImageConverter* converter, char* path, int display_width, int display_height) {
+
+    size_t cell_count = (size_t)display_width * display_height;
+    if (cell_count > converter->cells_capacity) {
+        free(converter->cell_storage);
+        free(converter->cells);
+        converter->cell_storage = malloc(cell_count * sizeof(TImageCell));
+        converter->cells = malloc(cell_count * sizeof(TImageCell*));
+        if (converter->cell_storage == NULL || converter->cells == NULL) {
+            converter_mem_error_exit_failing();
+        }
+        converter->cells_capacity = cell_count;
+    }
+
+    TImagePackedCell* packed = convert_image_to_packed_cells(converter, path, display_width, display_height, NULL);
+    for (size_t i = 0; i < cell_count; ++i) {
+        if (packed[i].glyph == EMPTY_CELL) {
+            converter->cells[i] = NULL;
+            continue;
+        }
+        TImageCell* cell = &converter->cell_storage[i];
+        cell->unicode = (char*)GLYPH_CHARACTERS[packed[i].glyph];
+        cell->text_color = packed[i].text_color;
+        cell->background_color = packed[i].background_color;
+        converter->cells[i] = cell;
+    }
+
+    return converter->cells;
+}
+
+/*
+    Builds a whole frame of ansii escape codes and characters in one buffer, so it can be
+    written to the terminal with a single write instead of a few printf's per cell.
+
+    Colors are only sent when they change from the cell before, and a space's text color
+    is never sent since it doesn't show. unoptimized_len keeps count of what sending both
+    colors for every cell (how ti used to print) would have taken.
+
+    Used like so:
+    ```
+    TImageFrameBuffer* frame = new_frame_buffer();
+    TImagePackedCell* cells = convert_image_to_packed_cells(converter, path, width, height, NULL);
+
+    frame_clear(frame);
+    frame_append_cells(frame, cells, width, height);
+    frame_write(frame, STDOUT_FILENO);
+
+    free_frame_buffer(frame);
+    ```
+*/
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+    size_t unoptimized_len;
+
+    // what the terminal is currently set to, one of the COLOR_ values or a 0xRRGGBB color
+    int32_t text_color;
+    int32_t background_color;
+} TImageFrameBuffer;
+
+#define COLOR_UNKNOWN -1
+#define COLOR_DEFAULT -2
+
+// the most a cell can take: both colors as one escape code and a 4 byte character
+#define MAX_CELL_BYTES 40
+
+static const char DIGIT_PAIRS[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static char* append_color_value(char* out, uint8_t value) {
+    if (value >= 100) {
+        *out++ = '0' + value / 100;
+        memcpy(out, &DIGIT_PAIRS[(value % 100) * 2], 2);
+        return out + 2;
+    }
+    if (value >= 10) {
+        memcpy(out, &DIGIT_PAIRS[value * 2], 2);
+        return out + 2;
+    }
+    *out++ = '0' + value;
+    return out;
+}
+
+static char* append_color(char* out, TImageColor color) {
+    out = append_color_value(out, color.r);
+    *out++ = ';';
+    out = append_color_value(out, color.g);
+    *out++ = ';';
+    return append_color_value(out, color.b);
+}
+
+static int color_value_digits(uint8_t value) {
+    return value >= 100? 3 : value >= 10? 2 : 1;
+}
+
+static int32_t color_to_int(TImageColor color) {
+    return (color.r << 16) | (color.g << 8) | color.b;
+}
+
+TImageFrameBuffer* new_frame_buffer() {
+    TImageFrameBuffer* frame = calloc(1, sizeof(TImageFrameBuffer));
+    if (frame == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    frame->text_color = COLOR_UNKNOWN;
+    frame->background_color = COLOR_UNKNOWN;
+    return frame;
+}
+
+void free_frame_buffer(TImageFrameBuffer* frame) {
+    free(frame->data);
+    free(frame);
+}
+
+/*
+    Empties the frame (keeping its memory) and forgets what the terminal colors are.
+*/
+void frame_clear(TImageFrameBuffer* frame) {
+    frame->len = 0;
+    frame->unoptimized_len = 0;
+    frame->text_color = COLOR_UNKNOWN;
+    frame->background_color = COLOR_UNKNOWN;
+}
+
+void frame_reserve(TImageFrameBuffer* frame, size_t bytes) {
+    size_t needed = frame->len + bytes;
+    if (needed > frame->capacity) {
+        size_t capacity = frame->capacity * 2;
+        if (capacity < needed) capacity = needed;
+        frame->data = grow_buffer(frame->data, &frame->capacity, capacity);
+    }
+}
+
+void frame_append(TImageFrameBuffer* frame, const char* bytes, size_t len) {
+    frame_reserve(frame, len);
+    memcpy(frame->data + frame->len, bytes, len);
+    frame->len += len;
+    frame->unoptimized_len += len;
+}
+
+/*
+    Resets the terminal colors (if they might not be already).
+*/
+void frame_append_reset(TImageFrameBuffer* frame) {
+    frame->unoptimized_len += 4;
+    if (frame->text_color == COLOR_DEFAULT && frame->background_color == COLOR_DEFAULT) return;
+
+    frame_reserve(frame, 4);
+    memcpy(frame->data + frame->len, "\033[0m", 4);
+    frame->len += 4;
+    frame->text_color = COLOR_DEFAULT;
+    frame->background_color = COLOR_DEFAULT;
+}
+
+/*
+    Appends one cell, only sending the colors that changed.
+*/
+void frame_append_cell(TImageFrameBuffer* frame, TImagePackedCell cell) {
+    frame_reserve(frame, MAX_CELL_BYTES);
+
+    if (cell.glyph == EMPTY_CELL) {
+        frame_append_reset(frame);
+        frame->data[frame->len++] = ' ';
+        frame->unoptimized_len += 1;
+        return;
+    }
+
+    const char* unicode = GLYPH_CHARACTERS[cell.glyph];
+    size_t unicode_len = strlen(unicode);
+    frame->unoptimized_len += 20 + unicode_len
+        + color_value_digits(cell.text_color.r) + color_value_digits(cell.text_color.g) + color_value_digits(cell.text_color.b)
+        + color_value_digits(cell.background_color.r) + color_value_digits(cell.background_color.g) + color_value_digits(cell.background_color.b);
+
+    // a space only shows its background
+    int32_t text_color = color_to_int(cell.text_color);
+    int32_t background_color = color_to_int(cell.background_color);
+    int is_text_shown = GLYPH_MASKS[cell.glyph][0] != 0 || GLYPH_MASKS[cell.glyph][1] != 0;
+    int is_text_changed = is_text_shown && text_color != frame->text_color;
+    int is_background_changed = background_color != frame->background_color;
+
+    // Foreground (text) = 38;2;r;g;b
+    // Background        = 48;2;r;g;b
+    char* out = frame->data + frame->len;
+    if (is_text_changed || is_background_changed) {
+        memcpy(out, "\033[", 2);
+        out += 2;
+        if (is_text_changed) {
+            memcpy(out, "38;2;", 5);
+            out = append_color(out + 5, cell.text_color);
+            frame->text_color = text_color;
+        }
+        if (is_text_changed && is_background_changed) {
+            *out++ = ';';
+        }
+        if (is_background_changed) {
+            memcpy(out, "48;2;", 5);
+            out = append_color(out + 5, cell.background_color);
+            frame->background_color = background_color;
+        }
+        *out++ = 'm';
+    }
+    memcpy(out, unicode, unicode_len);
+    out += unicode_len;
+    frame->len = out - frame->data;
+}
+
+/*
+    Appends display_width x display_height cells, resetting the colors at the end of each line.
+*/
+void frame_append_cells(TImageFrameBuffer* frame, TImagePackedCell* cells, int display_width, int display_height) {
+    frame_reserve(frame, (size_t)display_height * (display_width * MAX_CELL_BYTES + 5));
+    for (int y = 0; y < display_height; ++y) {
+        for (int x = 0; x < display_width; ++x) {
+            frame_append_cell(frame, cells[x + y * display_width]);
+        }
+        frame_append_reset(frame);
+        frame_append(frame, "\n", 1);
+    }
+}
+
+/*
+    Writes the whole frame to fd, returns 0 or -1 if writing failed (errno is set).
+*/
+int frame_write(TImageFrameBuffer* frame, int fd) {
+    size_t written = 0;
+    while (written < frame->len) {
+        ssize_t result = write(fd, frame->data + written, frame->len - written);
+        if (result < 0) {
+            if (errno == EAGAIN) {
+                wait_for_fd(fd, POLLOUT);
+                continue;
+            }
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        written += result;
+    }
+    return 0;
+}
+
+
+static char* append_int(char* out, int value) {
+    char digits[12];
+    int len = 0;
+    do {
+        digits[len++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    while (len > 0) {
+        *out++ = digits[--len];
+    }
+    return out;
+}
+
+/*
+    Moves the cursor to row, column (starting at 1, 1 in the top left of the terminal).
+*/
+void frame_append_cursor(TImageFrameBuffer* frame, int row, int column) {
+    frame_reserve(frame, 32);
+    char* out = frame->data + frame->len;
+    memcpy(out, "\033[", 2);
+    out = append_int(out + 2, row);
+    *out++ = ';';
+    out = append_int(out, column);
+    *out++ = 'H';
+    size_t len = out - (frame->data + frame->len);
+    frame->len += len;
+    frame->unoptimized_len += len;
+}
+
+
+/*
+    Redraws images in place, only sending the cells that changed since the last frame.
+
+    The presenter remembers the cells it last drew at row, column (1 based terminal
+    position of the top left cell). Each new frame is compared against them and only the
+    runs of changed cells are sent, each after a cursor move. When most of the cells
+    changed (more than full_redraw_ratio of them), or the size changed, it's cheaper to
+    redraw everything so that's done instead.
+
+    Used like so:
+    ```
+    TImagePresenter* presenter = new_presenter(1, 1);
+    TImageFrameBuffer* frame = new_frame_buffer();
+    while (next_frame(cells)) {
+        frame_clear(frame);
+        presenter_present(presenter, cells, width, height, frame);
+        frame_write(frame, STDOUT_FILENO);
+    }
+    free_frame_buffer(frame);
+    free_presenter(presenter);
+    ```
+
+    Call presenter_forget after anything else draws over the image (clearing the screen,
+    a resize) so the next frame is drawn in full.
+*/
+typedef struct {
+    int row;
+    int column;
+    double full_redraw_ratio;
+
+    // what's on screen
+    TImagePackedCell* cells;
+    size_t cells_capacity;
+    int width;
+    int height;
+    int has_frame;
+} TImagePresenter;
+
+// unchanged cells between two changed runs are resent rather than moving the cursor past them if there are this few
+#define PRESENTER_MAX_GAP 2
+
+TImagePresenter* new_presenter(int row, int column) {
+    TImagePresenter* presenter = calloc(1, sizeof(TImagePresenter));
+    if (presenter == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    presenter->row = row;
+    presenter->column = column;
+    presenter->full_redraw_ratio = 0.5;
+    return presenter;
+}
+
+void free_presenter(TImagePresenter* presenter) {
+    free(presenter->cells);
+    free(presenter);
+}
+
+void presenter_forget(TImagePresenter* presenter) {
+    presenter->has_frame = 0;
+}
+
+static int is_same_cell(TImagePackedCell a, TImagePackedCell b) {
+    uint64_t a_bits;
+    uint64_t b_bits;
+    memcpy(&a_bits, &a, sizeof(a_bits));
+    memcpy(&b_bits, &b, sizeof(b_bits));
+    return a_bits == b_bits;
+}
+
+/*
+    Appends what's needed to turn the last frame into cells (width x height) to frame,
+    returns the number of cells that changed.
+*/
+size_t presenter_present(TImagePresenter* presenter, TImagePackedCell* cells, int width, int height, TImageFrameBuffer* frame) {
+    size_t cell_count = (size_t)width * height;
+
+    int is_full_redraw = !presenter->has_frame || presenter->width != width || presenter->height != height;
+    size_t changed = cell_count;
+    if (!is_full_redraw) {
+        changed = 0;
+        for (size_t i = 0; i < cell_count; ++i) {
+            changed += !is_same_cell(cells[i], presenter->cells[i]);
+        }
+        is_full_redraw = changed > cell_count * presenter->full_redraw_ratio;
+    }
+
+    for (int y = 0; y < height; ++y) {
+        TImagePackedCell* row = cells + (size_t)y * width;
+        TImagePackedCell* shown = presenter->cells + (size_t)y * width;
+
+        if (is_full_redraw) {
+            frame_append_cursor(frame, presenter->row + y, presenter->column);
+            for (int x = 0; x < width; ++x) {
+                frame_append_cell(frame, row[x]);
+            }
+            continue;
+        }
+
+        int x = 0;
+        while (x < width) {
+            if (is_same_cell(row[x], shown[x])) {
+                ++x;
+                continue;
+            }
+
+            // extend the run over changed cells and small gaps of unchanged ones
+            int run_end = x + 1;
+            int gap = 0;
+            for (int next = run_end; next < width && gap <= PRESENTER_MAX_GAP; ++next) {
+                if (is_same_cell(row[next], shown[next])) {
+                    ++gap;
+                }
+                else {
+                    gap = 0;
+                    run_end = next + 1;
+                }
+            }
+
+            frame_append_cursor(frame, presenter->row + y, presenter->column + x);
+            for (; x < run_end; ++x) {
+                frame_append_cell(frame, row[x]);
+            }
+        }
+    }
+    if (changed > 0) {
+        frame_append_reset(frame);
+    }
+
+    presenter->cells = grow_buffer(presenter->cells, &presenter->cells_capacity, cell_count * sizeof(TImagePackedCell));
+    memcpy(presenter->cells, cells, cell_count * sizeof(TImagePackedCell));
+    presenter->width = width;
+    presenter->height = height;
+    presenter->has_frame = 1;
+
+    return changed;
+}
+
+
+
+/*
+    Streams an image to a file descriptor a row at a time: the calling thread (and the
+    converter's pool) converts the rows and a writer thread writes each one as soon as
+    it's ready, so the top of the image shows while the rest is still being converted.
+
+    Rows go from the converter to the writer through a single producer single consumer
+    ring of STREAM_RING_ROWS rows. head and tail are only ever written by one side each,
+    so handing a row over doesn't take a lock. The mutex is only for sleeping when the
+    ring is full (converter) or empty (writer): the side going to sleep counts itself in
+    waiting (holding the mutex) before looking at the ring again, and the other side only
+    takes the mutex to wake it when waiting isn't 0.
+
+    When fd isn't a terminal (a pipe or a file) nobody is watching the rows come in, so the
+    writer gathers them into writes of at least STREAM_WRITE_BYTES instead.
+
+    Used like so:
+    ```
+    TImageConverter* converter = new_image_converter();
+    size_t bytes;
+    if (stream_image(converter, "test/wizards.jpg", 80, 24, STDOUT_FILENO, &bytes) != 0) {
+        perror("write");
+    }
+    free_image_converter(converter);
+    ```
+*/
+#define STREAM_RING_ROWS 8
+#define STREAM_WRITE_BYTES (256 * 1024)
+
+typedef struct {
+    TImagePackedCell* rows; // STREAM_RING_ROWS rows of display_width cells
+    int display_width;
+    unsigned int head; // rows handed over, only written by the converting thread
+    unsigned int tail; // rows written out, only written by the writer thread
+    int waiting; // threads sleeping on changed
+    int is_done;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    int fd;
+    size_t write_bytes; // written once this many are waiting, 0 for every row
+    int error; // errno of the first failed write
+    size_t bytes_written;
+} TImageRowStream;
+
+// wakes the other thread if it's sleeping, after head or tail moved
+static void stream_wake(TImageRowStream* stream) {
+    if (__atomic_load_n(&stream->waiting, __ATOMIC_SEQ_CST) == 0) return;
+    pthread_mutex_lock(&stream->lock);
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+static void stream_push_row(void* arg, int row, TImagePackedCell* cells, int display_width) {
+    (void)row;
+    TImageRowStream* stream = arg;
+    unsigned int head = stream->head;
+
+    // wait for room
+    if (head - __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE) == STREAM_RING_ROWS) {
+        pthread_mutex_lock(&stream->lock);
+        __atomic_add_fetch(&stream->waiting, 1, __ATOMIC_SEQ_CST);
+        while (head - __atomic_load_n(&stream->tail, __ATOMIC_SEQ_CST) == STREAM_RING_ROWS) {
+            pthread_cond_wait(&stream->changed, &stream->lock);
+        }
+        __atomic_sub_fetch(&stream->waiting, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&stream->lock);
+    }
+
+    TImagePackedCell* slot = &stream->rows[(size_t)(head % STREAM_RING_ROWS) * display_width];
+    memcpy(slot, cells, display_width * sizeof(TImagePackedCell));
+    __atomic_store_n(&stream->head, head + 1, __ATOMIC_SEQ_CST);
+    stream_wake(stream);
+}
+
+static void stream_write_rows(TImageRowStream* stream, TImageFrameBuffer* frame) {
+    if (frame->len == 0) return;
+    if (frame_write(frame, stream->fd) != 0) {
+        stream->error = errno;
+    }
+    stream->bytes_written += frame->len;
+    frame->len = 0; // the colors are kept, the terminal still has them
+}
+
+static void* stream_writer(void* arg) {
+    TImageRowStream* stream = arg;
+    TImageFrameBuffer* frame = new_frame_buffer();
+    unsigned int tail = stream->tail;
+    for (;;) {
+
+        // wait for a row
+        if (__atomic_load_n(&stream->head, __ATOMIC_ACQUIRE) == tail) {
+            pthread_mutex_lock(&stream->lock);
+            __atomic_add_fetch(&stream->waiting, 1, __ATOMIC_SEQ_CST);
+            while (__atomic_load_n(&stream->head, __ATOMIC_SEQ_CST) == tail && !stream->is_done) {
+                pthread_cond_wait(&stream->changed, &stream->lock);
+            }
+            __atomic_sub_fetch(&stream->waiting, 1, __ATOMIC_SEQ_CST);
+            int is_finished = __atomic_load_n(&stream->head, __ATOMIC_ACQUIRE) == tail;
+            pthread_mutex_unlock(&stream->lock);
+            if (is_finished) break;
+        }
+
+        // keep going after a failed write so the converter never waits on a full ring
+        if (stream->error == 0) {
+            TImagePackedCell* row = &stream->rows[(size_t)(tail % STREAM_RING_ROWS) * stream->display_width];
+            frame_append_cells(frame, row, stream->display_width, 1);
+            if (frame->len >= stream->write_bytes) {
+                stream_write_rows(stream, frame);
+            }
+        }
+        __atomic_store_n(&stream->tail, ++tail, __ATOMIC_SEQ_CST);
+        stream_wake(stream);
+    }
+    if (stream->error == 0) {
+        stream_write_rows(stream, frame);
+    }
+    free_frame_buffer(frame);
+    return NULL;
+}
+
+/**
+ * Converts pixels and writes them to fd as ansii output, each row being written as soon as it's converted
+ * (or gathered into bigger writes when fd isn't a terminal, see TImageRowStream).
+ * The output is the same as frame_append_cells would make for the whole image.
+ * 
+ * Returns 0 or -1 if writing failed (errno is set). bytes_written (if not NULL) is set to the number of bytes written.
+ */
+int stream_pixels(
+    TImageConverter* converter,
+    const TImagePixels* pixels,
+    int display_width,
+    int display_height,
+    int fd,
+    size_t* bytes_written
+) {
+    TImageRowStream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.rows = malloc((size_t)STREAM_RING_ROWS * display_width * sizeof(TImagePackedCell));
+    if (stream.rows == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    stream.display_width = display_width;
+    stream.fd = fd;
+    stream.write_bytes = isatty(fd)? 0 : STREAM_WRITE_BYTES;
+    pthread_mutex_init(&stream.lock, NULL);
+    pthread_cond_init(&stream.changed, NULL);
+
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, stream_writer, &stream) != 0) {
+        fprintf(stderr, "Failed to start the writer thread. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+
+    convert_pixels_rows(converter, pixels, display_width, display_height, stream_push_row, &stream);
+
+    pthread_mutex_lock(&stream.lock);
+    stream.is_done = 1;
+    pthread_cond_broadcast(&stream.changed);
+    pthread_mutex_unlock(&stream.lock);
+    pthread_join(writer, NULL);
+
+    pthread_cond_destroy(&stream.changed);
+    pthread_mutex_destroy(&stream.lock);
+    free(stream.rows);
+
+    if (bytes_written != NULL) {
+        *bytes_written = stream.bytes_written;
+    }
+    if (stream.error != 0) {
+        errno = stream.error;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Same as stream_pixels for an image file.
+ */
+int stream_image(
+    TImageConverter* converter,
+    char* path,
+    int display_width,
+    int display_height,
+    int fd,
+    size_t* bytes_written
+) {
+    TImageLoaded* loaded = new_loaded_image(converter, path, display_width, display_height);
+    int result = stream_pixels(converter, &loaded->pixels, display_width, display_height, fd, bytes_written);
+    int error = errno;
+    free_loaded_image(loaded);
+    errno = error;
+    return result;
+}
+
+/*
+    The frames of an animated gif, decoded one at a time as they're asked for.
+
+    data has to stay valid until the animation is freed. Each frame is the whole canvas
+    (width x height, RGBA) as it looks once that frame is drawn and delay_ms is how long
+    it's shown for. Only the canvas and what it looked like before the last frame (for
+    undoing it, see the gif's disposal methods) are kept, so the memory used doesn't grow
+    with the number of frames.
+
+    Used like so:
+    ```
+    TImageAnimation* animation = new_gif_animation(data, len);
+    TImagePixels pixels;
+    int delay_ms;
+    while (animation_next_frame(animation, &pixels, &delay_ms)) {
+        convert_pixels_to_packed_cells(converter, &pixels, width, height, cells);
+    }
+    free_animation(animation);
+    ```
+*/
+typedef struct {
+    int width;
+    int height;
+    int frame_count;
+
+    const uint8_t* data;
+    int len;
+    int frames_decoded; // since the first frame
+    stbi__context context;
+    stbi__gif gif;
+} TImageAnimation;
+
+// like browsers, frames asking for less than GIF_MIN_DELAY_MS are shown for GIF_DEFAULT_DELAY_MS
+#define GIF_MIN_DELAY_MS 20
+#define GIF_DEFAULT_DELAY_MS 100
+
+// skips a run of gif sub blocks (each a length byte then that many bytes) up to the empty one ending it, returns where it ends or 0
+static size_t skip_gif_sub_blocks(const uint8_t* data, size_t len, size_t at) {
+    while (at < len && data[at] != 0) {
+        at += 1 + data[at];
+    }
+    return at < len? at + 1 : 0;
+}
+
+/*
+    Counts the frames in a gif by walking its blocks without decoding any pixels, returns 0 if
+    it isn't a gif. A gif that's cut short counts the frames it has.
+*/
+static int count_gif_frames(const uint8_t* data, size_t len) {
+    if (len < 13 || memcmp(data, "GIF8", 4) != 0) return 0;
+    size_t at = 13;
+    if (data[10] & 0x80) {
+        at += 3 * (2 << (data[10] & 7)); // global color table
+    }
+
+    int frames = 0;
+    while (at < len) {
+        uint8_t tag = data[at];
+        if (tag == 0x3B) {
+            return frames;
+        }
+        else if (tag == 0x21 && at + 2 <= len) {
+            at = skip_gif_sub_blocks(data, len, at + 2);
+        }
+        else if (tag == 0x2C && at + 10 <= len) {
+            uint8_t flags = data[at + 9];
+            at += 10;
+            if (flags & 0x80) {
+                at += 3 * (2 << (flags & 7)); // local color table
+            }
+            at = skip_gif_sub_blocks(data, len, at + 1); // after the lzw code size
+            if (at == 0) return frames; // a frame that's cut short isn't counted
+            frames++;
+        }
+        else {
+            return frames;
+        }
+        if (at == 0) return frames;
+    }
+    return frames;
+}
+
+// drops the decoding state so the next frame is the first one again
+static void reset_gif(TImageAnimation* animation) {
+    STBI_FREE(animation->gif.out);
+    STBI_FREE(animation->gif.background);
+    STBI_FREE(animation->gif.history);
+    memset(&animation->gif, 0, sizeof(animation->gif));
+    stbi__start_mem(&animation->context, animation->data, animation->len);
+    animation->frames_decoded = 0;
+}
+
+/*
+    Returns NULL if data isn't a gif that can be decoded (stbi_failure_reason says why).
+*/
+TImageAnimation* new_gif_animation(const uint8_t* data, size_t len) {
+    if (len > INT_MAX) {
+        stbi__err("too large", "Image file too large");
+        return NULL;
+    }
+    int frame_count = count_gif_frames(data, len);
+    if (frame_count == 0) {
+        stbi__err("not GIF", "Image was not as a gif type.");
+        return NULL;
+    }
+    TImageAnimation* animation = calloc(1, sizeof(TImageAnimation));
+    if (animation == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    animation->data = data;
+    animation->len = (int)len;
+    animation->frame_count = frame_count;
+    animation->width = data[6] | data[7] << 8;
+    animation->height = data[8] | data[9] << 8;
+    reset_gif(animation);
+    return animation;
+}
+
+void free_animation(TImageAnimation* animation) {
+    reset_gif(animation);
+    free(animation);
+}
+
+/*
+    Decodes the next frame, returns 0 after the last one (or if the rest of the gif is broken).
+    pixels stay valid until the next call. Only the frame_count whole frames are returned,
+    not the part of one a gif that's cut short ends with.
+*/
+int animation_next_frame(TImageAnimation* animation, TImagePixels* pixels, int* delay_ms) {
+    // the canvas from before the last frame is kept as the gif's background, which is what's needed
+    // to undo it for both "restore to background" and "restore to previous", so two_back isn't used
+    if (animation->frames_decoded == animation->frame_count) return 0;
+    int channels;
+    uint8_t* canvas = stbi__gif_load_next(&animation->context, &animation->gif, &channels, 4, NULL);
+    if (canvas == NULL || canvas == (uint8_t*)&animation->context) {
+        return 0;
+    }
+    animation->frames_decoded++;
+    *pixels = image_pixels(canvas, animation->gif.w, animation->gif.h, PIXEL_FORMAT_RGBA, 0);
+    int delay = animation->gif.delay;
+    *delay_ms = delay < GIF_MIN_DELAY_MS? GIF_DEFAULT_DELAY_MS : delay;
+    return 1;
+}
+
+// starts again from the first frame
+void animation_rewind(TImageAnimation* animation) {
+    reset_gif(animation);
+}
+
+
+/*
+    Plays an animation in place with each frame's timing, only sending the cells that
+    changed between frames (see TImagePresenter).
+
+    A converter thread converts the frames ahead of time (with the converter's pool) into
+    a ring of PLAYBACK_AHEAD_FRAMES frames of cells. Only the cells over pixels that changed
+    since the frame before are converted again (see convert_pixels_changes), most frames of
+    an animation only change a part of it. The calling thread waits for each frame's time and
+    draws it, a frame that wasn't ready in time is drawn as soon as it is and counted in
+    frames_late.
+
+    Used like so:
+    ```
+    TImagePlayback playback = {0};
+    playback.row = 1;
+    playback.column = 1;
+    playback.is_stopped = &is_stopped; // set by a SIGINT handler
+    play_animation(converter, animation, width, height, STDOUT_FILENO, &playback);
+    ```
+*/
+typedef struct {
+    int row;
+    int column;
+    int loops; // times to play the animation, 0 keeps playing until is_stopped is set
+    volatile sig_atomic_t* is_stopped; // playing stops once this isn't 0, can be NULL
+
+    // counted while playing
+    int frames_shown;
+    int frames_late;
+    int frames_dropped;
+    size_t bytes_written;
+    double seconds; // from drawing the first frame to the end
+} TImagePlayback;
+
+#define PLAYBACK_AHEAD_FRAMES 4
+// the longest the player waits without checking is_stopped
+#define PLAYBACK_POLL_MS 50
+// frames drawn more than this after their time are late
+#define PLAYBACK_LATE_MS 10
+
+typedef struct {
+    TImageConverter* converter;
+    TImageAnimation* animation;
+    TImagePlayback* playback;
+    int display_width;
+    int display_height;
+
+    // frames ready to be drawn, the converter thread moves head and the player moves tail
+    TImagePackedCell* frames;
+    int delays[PLAYBACK_AHEAD_FRAMES];
+    unsigned int head;
+    unsigned int tail;
+    int is_converted; // no more frames are coming
+    int is_finished; // the player stopped
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} TImagePlayer;
+
+static int is_playback_stopped(TImagePlayback* playback) {
+    return playback->is_stopped != NULL && *playback->is_stopped;
+}
+
+static double playback_now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// waits on changed for at most PLAYBACK_POLL_MS, lock has to be held
+static void poll_wait(pthread_cond_t* changed, pthread_mutex_t* lock) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += PLAYBACK_POLL_MS * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec += 1;
+        until.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(changed, lock, &until);
+}
+
+// sleeps until deadline_ms (see playback_now_ms) unless playing is stopped first
+static void playback_sleep_until(TImagePlayback* playback, double deadline_ms) {
+    for (;;) {
+        double wait_ms = deadline_ms - playback_now_ms();
+        if (wait_ms <= 0 || is_playback_stopped(playback)) return;
+        if (wait_ms > PLAYBACK_POLL_MS) wait_ms = PLAYBACK_POLL_MS;
+        struct timespec wait = {0, (long)(wait_ms * 1000000.0)};
+        nanosleep(&wait, NULL);
+    }
+}
+
+static void* player_converter(void* arg) {
+    TImagePlayer* player = arg;
+    TImageAnimation* animation = player->animation;
+    size_t cell_count = (size_t)player->display_width * player->display_height;
+    size_t row_length = (size_t)animation->width * 4;
+    TImagePackedCell* cells = malloc(cell_count * sizeof(TImagePackedCell));
+    uint8_t* previous_canvas = malloc(row_length * animation->height);
+    if (cells == NULL || previous_canvas == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    TImagePixels previous = image_pixels(previous_canvas, animation->width, animation->height, PIXEL_FORMAT_RGBA, 0);
+    int has_previous = 0;
+
+    int is_finished = 0;
+    for (int loop = 0; !is_finished && (player->playback->loops == 0 || loop < player->playback->loops); loop++) {
+        animation_rewind(animation);
+        TImagePixels pixels;
+        int delay_ms;
+        int frames = 0;
+        while (!is_finished && animation_next_frame(animation, &pixels, &delay_ms)) {
+            frames++;
+            if (has_previous) {
+                convert_pixels_changes(player->converter, &pixels, &previous, player->display_width, player->display_height, cells);
+            }
+            else {
+                convert_pixels_to_packed_cells(player->converter, &pixels, player->display_width, player->display_height, cells);
+                has_previous = 1;
+            }
+            for (int y = 0; y < pixels.height; y++) {
+                memcpy(previous_canvas + y * row_length, pixels.data + y * pixels.stride, row_length);
+            }
+
+            // wait for room
+            pthread_mutex_lock(&player->lock);
+            while (player->head - player->tail == PLAYBACK_AHEAD_FRAMES && !player->is_finished) {
+                pthread_cond_wait(&player->changed, &player->lock);
+            }
+            is_finished = player->is_finished;
+            pthread_mutex_unlock(&player->lock);
+            if (is_finished) break;
+
+            unsigned int slot = player->head % PLAYBACK_AHEAD_FRAMES;
+            memcpy(player->frames + slot * cell_count, cells, cell_count * sizeof(TImagePackedCell));
+            player->delays[slot] = delay_ms;
+            pthread_mutex_lock(&player->lock);
+            player->head++;
+            pthread_cond_broadcast(&player->changed);
+            pthread_mutex_unlock(&player->lock);
+        }
+        if (frames == 0) break;
+    }
+
+    pthread_mutex_lock(&player->lock);
+    player->is_converted = 1;
+    pthread_cond_broadcast(&player->changed);
+    pthread_mutex_unlock(&player->lock);
+    free(previous_canvas);
+    free(cells);
+    return NULL;
+}
+
+/**
+ * Plays animation at playback->row, playback->column (1 based, the top left cell) on fd, scaled to fit
+ * display_width x display_height cells. Returns once it's played playback->loops times or is stopped.
+ * 
+ * Returns 0 or -1 if writing failed (errno is set).
+ */
+int play_animation(
+    TImageConverter* converter,
+    TImageAnimation* animation,
+    int display_width,
+    int display_height,
+    int fd,
+    TImagePlayback* playback
+) {
+    size_t cell_count = (size_t)display_width * display_height;
+    TImagePlayer player;
+    memset(&player, 0, sizeof(player));
+    player.converter = converter;
+    player.animation = animation;
+    player.playback = playback;
+    player.display_width = display_width;
+    player.display_height = display_height;
+    player.frames = malloc(PLAYBACK_AHEAD_FRAMES * cell_count * sizeof(TImagePackedCell));
+    if (player.frames == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    pthread_mutex_init(&player.lock, NULL);
+    pthread_cond_init(&player.changed, NULL);
+
+    pthread_t converter_thread;
+    if (pthread_create(&converter_thread, NULL, player_converter, &player) != 0) {
+        fprintf(stderr, "Failed to start the converter thread. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+
+    TImagePresenter* presenter = new_presenter(playback->row, playback->column);
+    TImageFrameBuffer* frame = new_frame_buffer();
+    int error = 0;
+    double deadline_ms = 0;
+    double start_ms = playback_now_ms();
+    while (error == 0) {
+
+        // wait for the next frame
+        pthread_mutex_lock(&player.lock);
+        while (player.head == player.tail && !player.is_converted && !is_playback_stopped(playback)) {
+            poll_wait(&player.changed, &player.lock);
+        }
+        int is_ready = player.head != player.tail;
+        pthread_mutex_unlock(&player.lock);
+        if (!is_ready || is_playback_stopped(playback)) break;
+
+        // and for its time
+        unsigned int slot = player.tail % PLAYBACK_AHEAD_FRAMES;
+        double now_ms = playback_now_ms();
+        if (playback->frames_shown == 0) {
+            deadline_ms = now_ms;
+            start_ms = now_ms;
+        }
+        else if (now_ms > deadline_ms + PLAYBACK_LATE_MS) {
+            // start the timing over from here rather than rushing the next frames to catch up
+            playback->frames_late++;
+            deadline_ms = now_ms;
+        }
+        else {
+            playback_sleep_until(playback, deadline_ms);
+        }
+
+        frame_clear(frame);
+        presenter_present(presenter, player.frames + slot * cell_count, display_width, display_height, frame);
+        if (frame_write(frame, fd) != 0) {
+            error = errno;
+        }
+        playback->bytes_written += frame->len;
+        playback->frames_shown++;
+        deadline_ms += player.delays[slot];
+
+        pthread_mutex_lock(&player.lock);
+        player.tail++;
+        pthread_cond_broadcast(&player.changed);
+        pthread_mutex_unlock(&player.lock);
+    }
+    // the last frame stays up for its delay too
+    if (error == 0 && playback->frames_shown > 0) {
+        playback_sleep_until(playback, deadline_ms);
+    }
+    playback->seconds = (playback_now_ms() - start_ms) / 1000.0;
+
+    pthread_mutex_lock(&player.lock);
+    player.is_finished = 1;
+    pthread_cond_broadcast(&player.changed);
+    pthread_mutex_unlock(&player.lock);
+    pthread_join(converter_thread, NULL);
+
+    pthread_cond_destroy(&player.changed);
+    pthread_mutex_destroy(&player.lock);
+    free_frame_buffer(frame);
+    free_presenter(presenter);
+    free(player.frames);
+
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Plays raw video frames read from a file descriptor (like the output of
+    `ffmpeg -re -i video.mp4 -f rawvideo -pix_fmt rgba -`), each one frame_width x frame_height
+    pixels right after the one before.
+
+    A reader thread keeps reading frames as fast as they come and the calling thread converts
+    and draws the newest whole one each time it's done with the one before. Frames that come
+    in meanwhile are replaced by newer ones and counted in frames_dropped, so when converting
+    or the terminal falls behind the video skips frames rather than lagging further and further
+    behind (and whatever writes the frames isn't held up). The frames go between the threads
+    through VIDEO_BUFFERS buffers, one being read into, the newest whole frame, the one being
+    drawn and the one drawn before it (only the cells over pixels that changed since it are
+    converted again, see convert_pixels_changes), so no frame is copied.
+
+    Used like so:
+    ```
+    TImagePlayback playback = {0};
+    playback.row = 1;
+    playback.column = 1;
+    play_raw_video(converter, STDIN_FILENO, 640, 360, PIXEL_FORMAT_RGBA, width, height, STDOUT_FILENO, &playback);
+    printf("%.1f fps\n", playback.frames_shown / playback.seconds);
+    ```
+*/
+#define VIDEO_BUFFERS 4
+
+typedef struct {
+    int fd;
+    size_t frame_length;
+    uint8_t* buffers[VIDEO_BUFFERS];
+
+    // which buffer holds what, -1 for none
+    int ready; // the newest whole frame, not drawn yet
+    int drawing;
+    int drawn; // the frame before the one being drawn
+
+    int is_ended; // no more frames are coming
+    int is_finished; // the player stopped
+    int error; // errno if reading failed
+    int frames_dropped;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} TImageVideoReader;
+
+static void* video_reader(void* arg) {
+    TImageVideoReader* reader = arg;
+    int reading = 0;
+    for (;;) {
+
+        // read a whole frame, a part of one at the end of the input is dropped
+        size_t len = 0;
+        int error = 0;
+        while (len < reader->frame_length) {
+            if (__atomic_load_n(&reader->is_finished, __ATOMIC_ACQUIRE)) return NULL;
+            struct pollfd poll_fd = {reader->fd, POLLIN, 0};
+            if (poll(&poll_fd, 1, PLAYBACK_POLL_MS) == 0) continue;
+            ssize_t got = read(reader->fd, reader->buffers[reading] + len, reader->frame_length - len);
+            if (got < 0 && (errno == EINTR || errno == EAGAIN)) continue; // back to waiting in poll
+            if (got <= 0) {
+                error = got < 0? errno : 0;
+                break;
+            }
+            len += got;
+        }
+
+        pthread_mutex_lock(&reader->lock);
+        if (len < reader->frame_length) {
+            reader->is_ended = 1;
+            reader->error = error;
+            pthread_cond_broadcast(&reader->changed);
+            pthread_mutex_unlock(&reader->lock);
+            return NULL;
+        }
+        if (reader->ready >= 0) {
+            reader->frames_dropped++;
+        }
+        reader->ready = reading;
+
+        // the next frame goes in a buffer that isn't in use
+        reading = 0;
+        while (reading == reader->ready || reading == reader->drawing || reading == reader->drawn) {
+            reading++;
+        }
+        pthread_cond_broadcast(&reader->changed);
+        pthread_mutex_unlock(&reader->lock);
+    }
+}
+
+/**
+ * Plays raw video frames of the given size and format from in_fd until the input ends or playback->is_stopped
+ * is set, drawing them at playback->row, playback->column on fd scaled to fit display_width x display_height cells.
+ * 
+ * Returns 0 or -1 if reading or writing failed (errno is set).
+ */
+int play_raw_video(
+    TImageConverter* converter,
+    int in_fd,
+    int frame_width,
+    int frame_height,
+    TImagePixelFormat format,
+    int display_width,
+    int display_height,
+    int fd,
+    TImagePlayback* playback
+) {
+    TImageVideoReader reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.fd = in_fd;
+    reader.frame_length = (size_t)frame_width * frame_height * pixel_format_bytes(format);
+    for (int i = 0; i < VIDEO_BUFFERS; i++) {
+        reader.buffers[i] = malloc(reader.frame_length);
+        if (reader.buffers[i] == NULL) {
+            converter_mem_error_exit_failing();
+        }
+    }
+    reader.ready = -1;
+    reader.drawing = -1;
+    reader.drawn = -1;
+    pthread_mutex_init(&reader.lock, NULL);
+    pthread_cond_init(&reader.changed, NULL);
+
+    pthread_t reader_thread;
+    if (pthread_create(&reader_thread, NULL, video_reader, &reader) != 0) {
+        fprintf(stderr, "Failed to start the reader thread. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t cell_count = (size_t)display_width * display_height;
+    TImagePackedCell* cells = malloc(cell_count * sizeof(TImagePackedCell));
+    if (cells == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    TImagePresenter* presenter = new_presenter(playback->row, playback->column);
+    TImageFrameBuffer* frame = new_frame_buffer();
+    int error = 0;
+    double start_ms = playback_now_ms();
+    while (error == 0) {
+
+        // take the newest frame
+        pthread_mutex_lock(&reader.lock);
+        while (reader.ready < 0 && !reader.is_ended && !is_playback_stopped(playback)) {
+            poll_wait(&reader.changed, &reader.lock);
+        }
+        int drawn = reader.drawn;
+        reader.drawing = reader.ready;
+        reader.ready = -1;
+        pthread_mutex_unlock(&reader.lock);
+        if (reader.drawing < 0 || is_playback_stopped(playback)) break;
+
+        TImagePixels pixels = image_pixels(reader.buffers[reader.drawing], frame_width, frame_height, format, 0);
+        if (drawn < 0) {
+            convert_pixels_to_packed_cells(converter, &pixels, display_width, display_height, cells);
+            start_ms = playback_now_ms();
+        }
+        else {
+            TImagePixels previous = image_pixels(reader.buffers[drawn], frame_width, frame_height, format, 0);
+            convert_pixels_changes(converter, &pixels, &previous, display_width, display_height, cells);
+        }
+
+        frame_clear(frame);
+        presenter_present(presenter, cells, display_width, display_height, frame);
+        if (frame_write(frame, fd) != 0) {
+            error = errno;
+        }
+        playback->bytes_written += frame->len;
+        playback->frames_shown++;
+
+        pthread_mutex_lock(&reader.lock);
+        reader.drawn = reader.drawing;
+        reader.drawing = -1;
+        pthread_mutex_unlock(&reader.lock);
+    }
+    playback->seconds = (playback_now_ms() - start_ms) / 1000.0;
+
+    pthread_mutex_lock(&reader.lock);
+    __atomic_store_n(&reader.is_finished, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&reader.lock);
+    pthread_join(reader_thread, NULL);
+    playback->frames_dropped = reader.frames_dropped;
+    if (error == 0) {
+        error = reader.error;
+    }
+
+    pthread_cond_destroy(&reader.changed);
+    pthread_mutex_destroy(&reader.lock);
+    for (int i = 0; i < VIDEO_BUFFERS; i++) {
+        free(reader.buffers[i]);
+    }
+    free(cells);
+    free_frame_buffer(frame);
+    free_presenter(presenter);
+
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Converts a list of image files to ansii output files, job_count of them at a time.
+
+    Each job has its own converter (made like settings, with its glyph tables built once and its
+    buffers reused from image to image) and frame buffer, and takes the next image off the list
+    until there are none left. The output of each image goes to output_directory in a file named
+    after it with .ans on the end, written all at once. Images that can't be converted are
+    reported on stderr and counted in failed, the rest still are. So are images with the same
+    name as one before them in the list (like a/cover.jpg and b/cover.jpg), rather than
+    overwriting its file.
+
+    Used like so:
+    ```
+    TImageBatch batch = {0};
+    batch.display_width = 80;
+    batch.display_height = 24;
+    batch.job_count = 8;
+    batch.output_directory = "previews";
+    convert_image_batch(converter, paths, path_count, &batch);
+    printf("%.1f images/sec\n", batch.converted / batch.seconds);
+    ```
+*/
+typedef struct {
+    int display_width;
+    int display_height; // 0 for as many rows as each image needs at display_width (see display_height_for_width)
+    int job_count; // 0 for one per cpu core
+    const char* output_directory;
+
+    // counted while converting
+    int converted;
+    int failed;
+    size_t bytes_written;
+    double seconds;
+} TImageBatch;
+
+typedef struct {
+    TImageConverter* settings;
+    char** paths;
+    char** output_paths;
+    int* same_output; // the index of the path before it going to the same file, -1 for none
+    int path_count;
+    TImageBatch* batch;
+    int next_path; // taken with an atomic add
+    pthread_mutex_t lock; // for the counts
+} TImageBatchRun;
+
+// output_directory/name of the image.ans
+static char* batch_output_path(const char* output_directory, const char* path) {
+    const char* name = strrchr(path, '/');
+    name = name != NULL? name + 1 : path;
+    size_t length = strlen(output_directory) + strlen(name) + 6;
+    char* output_path = malloc(length);
+    if (output_path == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    snprintf(output_path, length, "%s/%s.ans", output_directory, name);
+    return output_path;
+}
+
+// converts one image to its output file, returns the bytes written or -1 (with reason set) if it failed
+static long convert_batch_image(
+    TImageConverter* converter,
+    TImageFrameBuffer* frame,
+    TImageBatch* batch,
+    char* path,
+    const char* output_path,
+    const char** reason
+) {
+    int display_height = batch->display_height > 0? batch->display_height : DISPLAY_HEIGHT_ANY;
+    TImageLoaded* loaded = try_load_image(converter, path, batch->display_width, display_height, reason);
+    if (loaded == NULL) {
+        return -1;
+    }
+    if (batch->display_height <= 0) {
+        display_height = display_height_for_width(loaded->pixels.width, loaded->pixels.height, batch->display_width);
+    }
+    TImagePackedCell* cells = convert_pixels_to_packed_cells(converter, &loaded->pixels, batch->display_width, display_height, NULL);
+    free_loaded_image(loaded);
+    frame_clear(frame);
+    frame_append_cells(frame, cells, batch->display_width, display_height);
+
+    int fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int result = fd < 0? -1 : frame_write(frame, fd);
+    if (fd >= 0 && close(fd) != 0) {
+        result = -1;
+    }
+    if (result != 0) {
+        *reason = strerror(errno);
+        return -1;
+    }
+    return frame->len;
+}
+
+// a converter made like settings for a job converting whole images in parallel with other jobs
+static TImageConverter* new_job_converter(TImageConverter* settings) {
+    TImageConverter* converter = new_image_converter();
+    converter->kmeans_iterations = settings->kmeans_iterations;
+    converter->match_glyph = settings->match_glyph;
+    converter->is_jpeg_downscaled = settings->is_jpeg_downscaled;
+    converter->is_thumbnail_used = settings->is_thumbnail_used;
+    converter->thread_count = 1; // the images are converted in parallel instead
+    return converter;
+}
+
+// runs job_count threads of job (0 for one per cpu core, never more than task_count) and waits for them
+static void run_jobs(void* (*job)(void*), void* arg, int job_count, int task_count) {
+    if (job_count <= 0) {
+        job_count = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (job_count > task_count) job_count = task_count;
+    if (job_count < 1) job_count = 1;
+
+    pthread_t* jobs = malloc(job_count * sizeof(pthread_t));
+    if (jobs == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    for (int i = 0; i < job_count; ++i) {
+        if (pthread_create(&jobs[i], NULL, job, arg) != 0) {
+            fprintf(stderr, "Failed to start the jobs. Exiting...");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < job_count; ++i) {
+        pthread_join(jobs[i], NULL);
+    }
+    free(jobs);
+}
+
+static void* batch_worker(void* arg) {
+    TImageBatchRun* run = arg;
+    TImageConverter* converter = new_job_converter(run->settings);
+    TImageFrameBuffer* frame = new_frame_buffer();
+
+    for (;;) {
+        int i = __atomic_fetch_add(&run->next_path, 1, __ATOMIC_RELAXED);
+        if (i >= run->path_count) break;
+
+        const char* reason = NULL;
+        long bytes = -1;
+        if (run->same_output[i] < 0) {
+            bytes = convert_batch_image(converter, frame, run->batch, run->paths[i], run->output_paths[i], &reason);
+        }
+        pthread_mutex_lock(&run->lock);
+        if (run->same_output[i] >= 0) {
+            fprintf(stderr, "Failed to convert %s: %s is already written to %s\n", run->paths[i], run->paths[run->same_output[i]], run->output_paths[i]);
+            run->batch->failed++;
+        }
+        else if (bytes < 0) {
+            fprintf(stderr, "Failed to convert %s: %s\n", run->paths[i], reason);
+            run->batch->failed++;
+        }
+        else {
+            run->batch->converted++;
+            run->batch->bytes_written += bytes;
+        }
+        pthread_mutex_unlock(&run->lock);
+    }
+
+    free_frame_buffer(frame);
+    free_image_converter(converter);
+    return NULL;
+}
+
+typedef struct {
+    const char* output_path;
+    int index;
+} TImageBatchOutput;
+
+static int compare_batch_outputs(const void* a, const void* b) {
+    const TImageBatchOutput* first = a;
+    const TImageBatchOutput* second = b;
+    int order = strcmp(first->output_path, second->output_path);
+    if (order != 0) return order;
+    return first->index - second->index;
+}
+
+// finds the paths whose output file is the same as one before them in the list
+static void find_same_outputs(char** output_paths, int path_count, int* same_output) {
+    TImageBatchOutput* outputs = malloc(path_count * sizeof(TImageBatchOutput));
+    if (path_count > 0 && outputs == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    for (int i = 0; i < path_count; ++i) {
+        outputs[i].output_path = output_paths[i];
+        outputs[i].index = i;
+        same_output[i] = -1;
+    }
+    qsort(outputs, path_count, sizeof(TImageBatchOutput), compare_batch_outputs);
+    int first = 0; // of the paths going to the same file, in list order
+    for (int i = 1; i < path_count; ++i) {
+        if (strcmp(outputs[i].output_path, outputs[first].output_path) == 0) {
+            same_output[outputs[i].index] = outputs[first].index;
+        }
+        else {
+            first = i;
+        }
+    }
+    free(outputs);
+}
+
+/**
+ * Converts every image in paths to a file in batch->output_directory (see TImageBatch), with the options
+ * set on settings. Returns once they're all done.
+ */
+void convert_image_batch(TImageConverter* settings, char** paths, int path_count, TImageBatch* batch) {
+    TImageBatchRun run;
+    memset(&run, 0, sizeof(run));
+    run.settings = settings;
+    run.paths = paths;
+    run.path_count = path_count;
+    run.batch = batch;
+    run.output_paths = malloc(path_count * sizeof(char*));
+    run.same_output = malloc(path_count * sizeof(int));
+    if (path_count > 0 && (run.output_paths == NULL || run.same_output == NULL)) {
+        converter_mem_error_exit_failing();
+    }
+    for (int i = 0; i < path_count; ++i) {
+        run.output_paths[i] = batch_output_path(batch->output_directory, paths[i]);
+    }
+    find_same_outputs(run.output_paths, path_count, run.same_output);
+    pthread_mutex_init(&run.lock, NULL);
+
+    double start_ms = playback_now_ms();
+    run_jobs(batch_worker, &run, batch->job_count, path_count);
+    batch->seconds = (playback_now_ms() - start_ms) / 1000.0;
+
+    pthread_mutex_destroy(&run.lock);
+    for (int i = 0; i < path_count; ++i) {
+        free(run.output_paths[i]);
+    }
+    free(run.output_paths);
+    free(run.same_output);
+}
+
+
+/*
+    A contact sheet: images laid out as a grid of thumbnails in one display_width x display_height
+    set of cells, with a GRID_GAP cell gap between them. Each image is fit in its tile (centered)
+    and the tiles are converted job_count at a time like convert_image_batch does, each job
+    writing straight into the sheet since the tiles don't overlap. Images that can't be
+    converted are reported on stderr and their tiles left empty.
+
+    With columns 0 the number of columns that shows square images biggest is used. With
+    display_height 0 the sheet is as tall as the rows of square-ish tiles need, and
+    display_height is set to that.
+
+    Used like so:
+    ```
+    TImageGrid grid = {0};
+    grid.display_width = 200;
+    grid.display_height = 60;
+    TImagePackedCell* cells = convert_image_grid(converter, paths, path_count, &grid);
+
+    frame_append_cells(frame, cells, grid.display_width, grid.display_height);
+    frame_write(frame, STDOUT_FILENO);
+    free(cells);
+    ```
+*/
+#define GRID_GAP 1
+
+typedef struct {
+    int display_width;
+    int display_height;
+    int columns; // 0 to pick them
+    int job_count; // 0 for one per cpu core
+
+    // set while converting
+    int rows;
+    int tile_width;
+    int tile_height;
+    int converted;
+    int failed;
+    double seconds;
+} TImageGrid;
+
+typedef struct {
+    TImageConverter* settings;
+    char** paths;
+    int path_count;
+    TImageGrid* grid;
+    TImagePackedCell* cells; // the whole sheet
+    int next_path; // taken with an atomic add
+    pthread_mutex_t lock; // for the counts
+} TImageGridRun;
+
+// the tile size for columns, with display_height 0 for tiles about as tall as they're wide
+static void grid_tile_size(int display_width, int display_height, int image_count, int columns, int* tile_width, int* tile_height) {
+    int rows = (image_count + columns - 1) / columns;
+    *tile_width = (display_width - (columns - 1) * GRID_GAP) / columns;
+    if (display_height > 0) {
+        *tile_height = (display_height - (rows - 1) * GRID_GAP) / rows;
+    }
+    else {
+        *tile_height = *tile_width * CURSOR_WIDTH / CURSOR_HEIGHT;
+    }
+    if (*tile_width < 1) *tile_width = 1;
+    if (*tile_height < 1) *tile_height = 1;
+}
+
+// the number of columns that makes a square image biggest in its tile
+static int grid_columns(int display_width, int display_height, int image_count) {
+    if (display_height <= 0) {
+        int columns = 1;
+        while (columns * columns < image_count) columns++;
+        return columns;
+    }
+    int best_columns = 1;
+    int best_size = 0;
+    for (int columns = 1; columns <= image_count; ++columns) {
+        int tile_width, tile_height;
+        grid_tile_size(display_width, display_height, image_count, columns, &tile_width, &tile_height);
+        int size = tile_width * CURSOR_WIDTH < tile_height * CURSOR_HEIGHT? tile_width * CURSOR_WIDTH : tile_height * CURSOR_HEIGHT;
+        if (size > best_size) {
+            best_size = size;
+            best_columns = columns;
+        }
+    }
+    return best_columns;
+}
+
+// converts image i into its tile of the sheet, returns -1 (and why in reason) if it couldn't be loaded
+static int convert_grid_tile(TImageConverter* converter, TImageGridRun* run, TImagePackedCell* tile, int i, const char** reason) {
+    TImageGrid* grid = run->grid;
+    TImageLoaded* loaded = try_load_image(converter, run->paths[i], grid->tile_width, grid->tile_height, reason);
+    if (loaded == NULL) {
+        return -1;
+    }
+    convert_pixels_to_packed_cells(converter, &loaded->pixels, grid->tile_width, grid->tile_height, tile);
+
+    // the cells the image fills, centered in the tile
+    int new_width, new_height;
+    scaled_image_size(loaded->pixels.width, loaded->pixels.height, grid->tile_width, grid->tile_height, &new_width, &new_height);
+    free_loaded_image(loaded);
+    int used_width = new_width / CURSOR_WIDTH;
+    int used_height = new_height / CURSOR_HEIGHT;
+    if (used_width > grid->tile_width) used_width = grid->tile_width;
+    if (used_height > grid->tile_height) used_height = grid->tile_height;
+
+    int column = i % grid->columns;
+    int row = i / grid->columns;
+    int x_start = column * (grid->tile_width + GRID_GAP) + (grid->tile_width - used_width) / 2;
+    int y_start = row * (grid->tile_height + GRID_GAP) + (grid->tile_height - used_height) / 2;
+    for (int y = 0; y < used_height; ++y) {
+        memcpy(
+            &run->cells[(size_t)(y_start + y) * grid->display_width + x_start],
+            &tile[(size_t)y * grid->tile_width],
+            used_width * sizeof(TImagePackedCell)
+        );
+    }
+    return 0;
+}
+
+static void* grid_worker(void* arg) {
+    TImageGridRun* run = arg;
+    TImageConverter* converter = new_job_converter(run->settings);
+    TImagePackedCell* tile = malloc((size_t)run->grid->tile_width * run->grid->tile_height * sizeof(TImagePackedCell));
+    if (tile == NULL) {
+        converter_mem_error_exit_failing();
+    }
+
+    for (;;) {
+        int i = __atomic_fetch_add(&run->next_path, 1, __ATOMIC_RELAXED);
+        if (i >= run->path_count) break;
+
+        const char* reason = NULL;
+        int result = convert_grid_tile(converter, run, tile, i, &reason);
+        pthread_mutex_lock(&run->lock);
+        if (result != 0) {
+            fprintf(stderr, "Failed to convert %s: %s\n", run->paths[i], reason);
+            run->grid->failed++;
+        }
+        else {
+            run->grid->converted++;
+        }
+        pthread_mutex_unlock(&run->lock);
+    }
+
+    free(tile);
+    free_image_converter(converter);
+    return NULL;
+}
+
+/**
+ * Converts the images in paths into a contact sheet (see TImageGrid), with the options set on settings.
+ * Returns grid->display_width x grid->display_height cells (free them when done), or NULL if there are
+ * more images than fit (as the tiles would be smaller than a cell).
+ */
+TImagePackedCell* convert_image_grid(TImageConverter* settings, char** paths, int path_count, TImageGrid* grid) {
+    if (path_count < 1 || grid->display_width < 1) {
+        return NULL;
+    }
+    if (grid->columns <= 0) {
+        grid->columns = grid_columns(grid->display_width, grid->display_height, path_count);
+    }
+    if (grid->columns > path_count) grid->columns = path_count;
+    grid->rows = (path_count + grid->columns - 1) / grid->columns;
+    grid_tile_size(grid->display_width, grid->display_height, path_count, grid->columns, &grid->tile_width, &grid->tile_height);
+    if (grid->display_height <= 0) {
+        grid->display_height = grid->rows * (grid->tile_height + GRID_GAP) - GRID_GAP;
+    }
+    if (
+        grid->columns * (grid->tile_width + GRID_GAP) - GRID_GAP > grid->display_width ||
+        grid->rows * (grid->tile_height + GRID_GAP) - GRID_GAP > grid->display_height
+    ) {
+        return NULL;
+    }
+
+    size_t cell_count = (size_t)grid->display_width * grid->display_height;
+    TImagePackedCell* cells = malloc(cell_count * sizeof(TImagePackedCell));
+    if (cells == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    TImagePackedCell empty = {EMPTY_CELL, {0, 0, 0}, {0, 0, 0}, 0};
+    for (size_t i = 0; i < cell_count; ++i) {
+        cells[i] = empty;
+    }
+
+    TImageGridRun run;
+    memset(&run, 0, sizeof(run));
+    run.settings = settings;
+    run.paths = paths;
+    run.path_count = path_count;
+    run.grid = grid;
+    run.cells = cells;
+    pthread_mutex_init(&run.lock, NULL);
+
+    double start_ms = playback_now_ms();
+    run_jobs(grid_worker, &run, grid->job_count, path_count);
+    grid->seconds = (playback_now_ms() - start_ms) / 1000.0;
+
+    pthread_mutex_destroy(&run.lock);
+    return cells;
+}
+
+
+/*
+    A slideshow over a list of image files, which converts the slides next to the one being
+    shown (SLIDESHOW_AHEAD of them on either side, wrapping around) in the background, so
+    flipping to one of them is just writing out output that's already made.
+
+    Slides are kept as their finished ansii output. A prefetcher thread with its own single
+    threaded converter takes the nearest slide that isn't made yet, as long as they all take
+    less than memory_cap bytes. When a made slide doesn't fit, the ones furthest from the
+    current slide are dropped for it, or it's dropped itself (and prefetching waits for the
+    current slide to change) if they're all nearer. The slide being shown is always kept and
+    is converted with the caller's converter (all of its threads) if it wasn't made in time.
+
+    Used like so:
+    ```
+    TImageSlideshow* slideshow = new_slideshow(converter, paths, path_count, 80, 24, 64 * 1024 * 1024);
+    size_t len;
+    const char* reason;
+    const char* output = slideshow_slide(slideshow, index, &len, &reason);
+    if (output != NULL) {
+        write(STDOUT_FILENO, output, len);
+    }
+    free_slideshow(slideshow);
+    ```
+*/
+#define SLIDESHOW_AHEAD 2
+
+#define SLIDE_EMPTY 0
+#define SLIDE_CONVERTING 1
+#define SLIDE_READY 2
+#define SLIDE_FAILED 3
+
+typedef struct {
+    int state; // one of the SLIDE_ values
+    char* output;
+    size_t len;
+    const char* reason; // why it failed
+} TImageSlide;
+
+typedef struct {
+    TImageConverter* converter;
+    char** paths;
+    int path_count;
+    int display_width;
+    int display_height;
+    size_t memory_cap;
+
+    TImageSlide* slides;
+    TImageFrameBuffer* frame; // for making the current slide
+    size_t memory_used;
+    int current;
+    int is_full; // nothing else fits until current changes
+    int generation; // changes when the size does, so slides made at the old size are dropped
+    int is_stopped;
+    pthread_t prefetcher;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    // counts
+    int slides_ready; // shown without waiting for them to be converted
+    int slides_converted; // shown after converting them
+} TImageSlideshow;
+
+// how many slides apart from the current one index is, going whichever way is shorter
+static int slide_distance(TImageSlideshow* slideshow, int index) {
+    int distance = abs(index - slideshow->current);
+    if (slideshow->path_count - distance < distance) {
+        distance = slideshow->path_count - distance;
+    }
+    return distance;
+}
+
+static void drop_slide(TImageSlideshow* slideshow, TImageSlide* slide) {
+    slideshow->memory_used -= slide->len;
+    free(slide->output);
+    slide->output = NULL;
+    slide->len = 0;
+    slide->state = SLIDE_EMPTY;
+}
+
+// drops slides further than distance from the current one (furthest first) until there's room for bytes more
+static int make_slide_room(TImageSlideshow* slideshow, size_t bytes, int distance) {
+    while (slideshow->memory_used + bytes > slideshow->memory_cap) {
+        int furthest = -1;
+        for (int i = 0; i < slideshow->path_count; ++i) {
+            if (slideshow->slides[i].state != SLIDE_READY || slide_distance(slideshow, i) <= distance) continue;
+            if (furthest == -1 || slide_distance(slideshow, i) > slide_distance(slideshow, furthest)) {
+                furthest = i;
+            }
+        }
+        if (furthest == -1) return 0;
+        drop_slide(slideshow, &slideshow->slides[furthest]);
+    }
+    return 1;
+}
+
+// the nearest slide to the current one that isn't made yet, or -1
+static int next_slide_to_make(TImageSlideshow* slideshow) {
+    if (slideshow->is_full || slideshow->memory_used >= slideshow->memory_cap) return -1;
+    for (int distance = 1; distance <= SLIDESHOW_AHEAD && distance * 2 <= slideshow->path_count; ++distance) {
+        int after = (slideshow->current + distance) % slideshow->path_count;
+        int before = (slideshow->current - distance + slideshow->path_count) % slideshow->path_count;
+        if (slideshow->slides[after].state == SLIDE_EMPTY) return after;
+        if (slideshow->slides[before].state == SLIDE_EMPTY) return before;
+    }
+    return -1;
+}
+
+// converts the image at path into ansii output (a copy of just the bytes it takes), returns NULL (and why in reason) if it couldn't be loaded
+static char* make_slide(
+    TImageConverter* converter,
+    TImageFrameBuffer* frame,
+    char* path,
+    int display_width,
+    int display_height,
+    size_t* len,
+    const char** reason
+) {
+    TImageLoaded* loaded = try_load_image(converter, path, display_width, display_height, reason);
+    if (loaded == NULL) {
+        return NULL;
+    }
+    TImagePackedCell* cells = convert_pixels_to_packed_cells(converter, &loaded->pixels, display_width, display_height, NULL);
+    free_loaded_image(loaded);
+    frame_clear(frame);
+    frame_append_cells(frame, cells, display_width, display_height);
+
+    char* output = malloc(frame->len);
+    if (output == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    memcpy(output, frame->data, frame->len);
+    *len = frame->len;
+    return output;
+}
+
+// puts what make_slide made into the slide, lock has to be held
+static void set_slide(TImageSlideshow* slideshow, TImageSlide* slide, char* output, size_t len, const char* reason) {
+    slide->output = output;
+    slide->len = len;
+    slide->reason = reason;
+    slide->state = output != NULL? SLIDE_READY : SLIDE_FAILED;
+    slideshow->memory_used += len;
+}
+
+static void* slideshow_prefetcher(void* arg) {
+    TImageSlideshow* slideshow = arg;
+    TImageConverter* converter = new_job_converter(slideshow->converter);
+    TImageFrameBuffer* frame = new_frame_buffer();
+
+    pthread_mutex_lock(&slideshow->lock);
+    while (!slideshow->is_stopped) {
+        int index = next_slide_to_make(slideshow);
+        if (index == -1) {
+            pthread_cond_wait(&slideshow->changed, &slideshow->lock);
+            continue;
+        }
+        TImageSlide* slide = &slideshow->slides[index];
+        slide->state = SLIDE_CONVERTING;
+        int generation = slideshow->generation;
+        int display_width = slideshow->display_width;
+        int display_height = slideshow->display_height;
+        pthread_mutex_unlock(&slideshow->lock);
+
+        size_t len = 0;
+        const char* reason = NULL;
+        char* output = make_slide(converter, frame, slideshow->paths[index], display_width, display_height, &len, &reason);
+
+        pthread_mutex_lock(&slideshow->lock);
+        if (generation != slideshow->generation) {
+            // made at a size that isn't used anymore, the slide was already emptied
+            free(output);
+        }
+        else if (!make_slide_room(slideshow, len, slide_distance(slideshow, index))) {
+            free(output);
+            slide->state = SLIDE_EMPTY;
+            slideshow->is_full = 1;
+        }
+        else {
+            set_slide(slideshow, slide, output, len, reason);
+        }
+        pthread_cond_broadcast(&slideshow->changed);
+    }
+    pthread_mutex_unlock(&slideshow->lock);
+
+    free_frame_buffer(frame);
+    free_image_converter(converter);
+    return NULL;
+}
+
+/**
+ * Starts a slideshow over paths (see TImageSlideshow), converting them with converter's options at
+ * display_width x display_height cells and keeping at most about memory_cap bytes of slides.
+ */
+TImageSlideshow* new_slideshow(
+    TImageConverter* converter,
+    char** paths,
+    int path_count,
+    int display_width,
+    int display_height,
+    size_t memory_cap
+) {
+    TImageSlideshow* slideshow = calloc(1, sizeof(TImageSlideshow));
+    if (slideshow == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    slideshow->slides = calloc(path_count, sizeof(TImageSlide));
+    if (slideshow->slides == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    slideshow->frame = new_frame_buffer();
+    slideshow->converter = converter;
+    slideshow->paths = paths;
+    slideshow->path_count = path_count;
+    slideshow->display_width = display_width;
+    slideshow->display_height = display_height;
+    slideshow->memory_cap = memory_cap;
+    pthread_mutex_init(&slideshow->lock, NULL);
+    pthread_cond_init(&slideshow->changed, NULL);
+
+    if (pthread_create(&slideshow->prefetcher, NULL, slideshow_prefetcher, slideshow) != 0) {
+        fprintf(stderr, "Failed to start the prefetcher thread. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    return slideshow;
+}
+
+void free_slideshow(TImageSlideshow* slideshow) {
+    pthread_mutex_lock(&slideshow->lock);
+    slideshow->is_stopped = 1;
+    pthread_cond_broadcast(&slideshow->changed);
+    pthread_mutex_unlock(&slideshow->lock);
+    pthread_join(slideshow->prefetcher, NULL);
+
+    for (int i = 0; i < slideshow->path_count; ++i) {
+        free(slideshow->slides[i].output);
+    }
+    free(slideshow->slides);
+    free_frame_buffer(slideshow->frame);
+    pthread_cond_destroy(&slideshow->changed);
+    pthread_mutex_destroy(&slideshow->lock);
+    free(slideshow);
+}
+
+/**
+ * Changes the size the slides are made at, dropping the ones already made.
+ */
+void slideshow_resize(TImageSlideshow* slideshow, int display_width, int display_height) {
+    pthread_mutex_lock(&slideshow->lock);
+    if (display_width != slideshow->display_width || display_height != slideshow->display_height) {
+        slideshow->display_width = display_width;
+        slideshow->display_height = display_height;
+        slideshow->generation++;
+        slideshow->is_full = 0;
+        for (int i = 0; i < slideshow->path_count; ++i) {
+            drop_slide(slideshow, &slideshow->slides[i]);
+        }
+        pthread_cond_broadcast(&slideshow->changed);
+    }
+    pthread_mutex_unlock(&slideshow->lock);
+}
+
+/**
+ * Makes index the current slide and returns its ansii output (len bytes), converting it first if the
+ * prefetcher hasn't already. Returns NULL (and why in reason) if the image couldn't be loaded.
+ * The output stays valid until the next call.
+ */
+const char* slideshow_slide(TImageSlideshow* slideshow, int index, size_t* len, const char** reason) {
+    pthread_mutex_lock(&slideshow->lock);
+    if (index != slideshow->current) {
+        slideshow->current = index;
+        slideshow->is_full = 0;
+        pthread_cond_broadcast(&slideshow->changed);
+    }
+
+    // the prefetcher might be part way through it
+    TImageSlide* slide = &slideshow->slides[index];
+    int was_converting = slide->state == SLIDE_CONVERTING;
+    while (slide->state == SLIDE_CONVERTING) {
+        pthread_cond_wait(&slideshow->changed, &slideshow->lock);
+    }
+    if (slide->state == SLIDE_EMPTY) {
+        slide->state = SLIDE_CONVERTING;
+        int display_width = slideshow->display_width;
+        int display_height = slideshow->display_height;
+        pthread_mutex_unlock(&slideshow->lock);
+
+        size_t output_len = 0;
+        const char* output_reason = NULL;
+        char* output = make_slide(
+            slideshow->converter,
+            slideshow->frame,
+            slideshow->paths[index],
+            display_width,
+            display_height,
+            &output_len,
+            &output_reason
+        );
+
+        pthread_mutex_lock(&slideshow->lock);
+        make_slide_room(slideshow, output_len, 0);
+        set_slide(slideshow, slide, output, output_len, output_reason);
+        slideshow->slides_converted++;
+        pthread_cond_broadcast(&slideshow->changed);
+    }
+    else if (was_converting) {
+        slideshow->slides_converted++;
+    }
+    else {
+        slideshow->slides_ready++;
+    }
+
+    const char* output = slide->output;
+    *len = slide->len;
+    *reason = slide->reason;
+    pthread_mutex_unlock(&slideshow->lock);
+    return output;
+}
+
+
+/*
+    A ring of frames in POSIX shared memory, for programs making frames to hand them over
+    without copying them through a pipe.
+
+    The shared memory starts with a TImageRingHeader followed by slot_count slots of
+    slot_length bytes, each holding one frame (height rows, stride bytes apart). The
+    producer writes frame seq into slot seq % slot_count and then sets the header's seq to
+    seq + 1, so the newest whole frame is always in slot (seq - 1) % slot_count. seq is also
+    a futex the producer wakes after each frame, so a consumer sleeps until there's a new one.
+
+    Frames are read in place. Each slot has its own sequence number (slot_seqs) which is 0
+    while the producer is writing to it, so a reader that was overtaken by the producer can
+    tell the frame changed while it was reading it (like a seqlock).
+
+    Used like so (producer):
+    ```
+    TImageRing* ring = new_frame_ring("/ti_frames", 640, 360, 640 * 4, PIXEL_FORMAT_RGBA, 4);
+    while (capturing) {
+        uint8_t* frame = ring_frame_to_write(ring);
+        capture(frame);
+        ring_publish_frame(ring);
+    }
+    close_frame_ring(ring);
+    ```
+    and the consumer `play_frame_ring(converter, open_frame_ring("/ti_frames"), ...)` or `ti -m /ti_frames`.
+*/
+#define RING_MAGIC 0x54494d52 // TIMR
+#define RING_VERSION 1
+#define RING_MAX_SLOTS 16
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t format; // a TImagePixelFormat
+    uint32_t slot_count;
+    uint32_t is_closed; // the producer is done
+    uint64_t slot_offset; // bytes from the start of the shared memory to the first slot
+    uint64_t slot_length;
+    uint32_t seq; // frames published so far
+    uint32_t slot_seqs[RING_MAX_SLOTS]; // seq + 1 of the frame in each slot, 0 while it's written
+} TImageRingHeader;
+
+typedef struct {
+    TImageRingHeader* header;
+    TImageRingHeader layout; // a copy of the header's sizes once they were checked, the producer can't change them afterwards
+    uint8_t* memory;
+    size_t length;
+    char* name; // set for the producer, which removes the shared memory when it closes the ring
+} TImageRing;
+
+static void ring_wake(TImageRingHeader* header) {
+#ifdef __linux__
+    syscall(SYS_futex, &header->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)header;
+#endif
+}
+
+// sleeps until seq isn't seen anymore or PLAYBACK_POLL_MS go by
+static void ring_wait(TImageRingHeader* header, uint32_t seen) {
+#ifdef __linux__
+    struct timespec wait = {0, PLAYBACK_POLL_MS * 1000000L};
+    syscall(SYS_futex, &header->seq, FUTEX_WAIT, seen, &wait, NULL, 0);
+#else
+    (void)seen;
+    struct timespec wait = {0, 1000000L};
+    if (__atomic_load_n(&header->seq, __ATOMIC_ACQUIRE) == seen) nanosleep(&wait, NULL);
+#endif
+}
+
+static TImageRing* map_frame_ring(int shm_fd, size_t length, int is_writable) {
+    int protection = is_writable? PROT_READ | PROT_WRITE : PROT_READ;
+    void* memory = mmap(NULL, length, protection, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    TImageRing* ring = calloc(1, sizeof(TImageRing));
+    if (ring == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    ring->memory = memory;
+    ring->header = memory;
+    ring->length = length;
+    return ring;
+}
+
+/*
+    Creates the shared memory called name (like "/ti_frames") for a ring of slot_count frames, replacing
+    any left over from before. Returns NULL if it can't be made (errno is set).
+*/
+TImageRing* new_frame_ring(const char* name, int width, int height, int stride, TImagePixelFormat format, int slot_count) {
+    if (width <= 0 || height <= 0 || stride < width * pixel_format_bytes(format) || slot_count < 2 || slot_count > RING_MAX_SLOTS) {
+        errno = EINVAL;
+        return NULL;
+    }
+    size_t slot_offset = (sizeof(TImageRingHeader) + 63) / 64 * 64;
+    size_t slot_length = ((size_t)stride * height + 63) / 64 * 64;
+    size_t length = slot_offset + slot_length * slot_count;
+
+    shm_unlink(name);
+    int shm_fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (shm_fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(shm_fd, length) != 0) {
+        int error = errno;
+        close(shm_fd);
+        shm_unlink(name);
+        errno = error;
+        return NULL;
+    }
+    TImageRing* ring = map_frame_ring(shm_fd, length, 1);
+    if (ring == NULL) {
+        int error = errno;
+        shm_unlink(name);
+        errno = error;
+        return NULL;
+    }
+    ring->name = strdup(name);
+
+    TImageRingHeader* header = ring->header;
+    header->version = RING_VERSION;
+    header->width = width;
+    header->height = height;
+    header->stride = stride;
+    header->format = format;
+    header->slot_count = slot_count;
+    header->slot_offset = slot_offset;
+    header->slot_length = slot_length;
+    ring->layout = *header;
+    __atomic_store_n(&header->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    return ring;
+}
+
+// whether the sizes in a ring's header fit in length bytes of shared memory, without overflowing on sizes made up to get past the check
+static int is_ring_layout_valid(const TImageRingHeader* layout, size_t length) {
+    if (layout->format < PIXEL_FORMAT_GRAY || layout->format > PIXEL_FORMAT_BGRA) return 0;
+    uint64_t row_bytes;
+    uint64_t frame_bytes;
+    uint64_t slots_bytes;
+    uint64_t end;
+    return layout->version == RING_VERSION
+        && layout->width > 0
+        && layout->width <= INT_MAX
+        && layout->height > 0
+        && layout->height <= INT_MAX
+        && layout->stride <= INT_MAX
+        && !__builtin_mul_overflow((uint64_t)layout->width, (uint64_t)pixel_format_bytes(layout->format), &row_bytes)
+        && layout->stride >= row_bytes
+        && layout->slot_count >= 2
+        && layout->slot_count <= RING_MAX_SLOTS
+        && !__builtin_mul_overflow((uint64_t)layout->stride, (uint64_t)layout->height, &frame_bytes)
+        && frame_bytes <= INT_MAX // the scaler indexes a frame's pixels with ints
+        && layout->slot_length >= frame_bytes
+        && layout->slot_offset >= sizeof(TImageRingHeader)
+        && !__builtin_mul_overflow(layout->slot_length, (uint64_t)layout->slot_count, &slots_bytes)
+        && !__builtin_add_overflow(layout->slot_offset, slots_bytes, &end)
+        && end <= length;
+}
+
+/*
+    Attaches to the ring a producer made with new_frame_ring, read only. Returns NULL if there's
+    no such shared memory or it isn't a ring (errno is set).
+*/
+TImageRing* open_frame_ring(const char* name) {
+    int shm_fd = shm_open(name, O_RDONLY, 0);
+    if (shm_fd < 0) {
+        return NULL;
+    }
+    struct stat status;
+    if (fstat(shm_fd, &status) != 0 || (size_t)status.st_size < sizeof(TImageRingHeader)) {
+        close(shm_fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    TImageRing* ring = map_frame_ring(shm_fd, status.st_size, 0);
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    // the header is checked from a copy, as the other process can change it at any time
+    int is_valid = __atomic_load_n(&ring->header->magic, __ATOMIC_ACQUIRE) == RING_MAGIC;
+    memcpy(&ring->layout, ring->header, sizeof(TImageRingHeader));
+    if (!is_valid || !is_ring_layout_valid(&ring->layout, ring->length)) {
+        munmap(ring->memory, ring->length);
+        free(ring);
+        errno = EINVAL;
+        return NULL;
+    }
+    return ring;
+}
+
+/*
+    Detaches from the ring. For the producer this also tells consumers it's done and removes
+    the shared memory (consumers still attached keep theirs until they close it).
+*/
+void close_frame_ring(TImageRing* ring) {
+    if (ring->name != NULL) {
+        __atomic_store_n(&ring->header->is_closed, 1, __ATOMIC_RELEASE);
+        ring_wake(ring->header);
+        shm_unlink(ring->name);
+        free(ring->name);
+    }
+    munmap(ring->memory, ring->length);
+    free(ring);
+}
+
+static uint8_t* ring_slot(TImageRing* ring, uint32_t seq) {
+    TImageRingHeader* layout = &ring->layout;
+    return ring->memory + layout->slot_offset + (seq % layout->slot_count) * layout->slot_length;
+}
+
+/*
+    The slot the producer's next frame goes in, call ring_publish_frame once it's written.
+*/
+uint8_t* ring_frame_to_write(TImageRing* ring) {
+    TImageRingHeader* header = ring->header;
+    uint32_t seq = header->seq;
+    __atomic_store_n(&header->slot_seqs[seq % ring->layout.slot_count], 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // readers see the slot is being written before any of the frame changes
+    return ring_slot(ring, seq);
+}
+
+void ring_publish_frame(TImageRing* ring) {
+    TImageRingHeader* header = ring->header;
+    uint32_t seq = header->seq;
+    __atomic_store_n(&header->slot_seqs[seq % ring->layout.slot_count], seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->seq, seq + 1, __ATOMIC_RELEASE);
+    ring_wake(header);
+}
+
+// whether the frame seq (counting from 1) is still whole in its slot, call after reading it
+static int is_ring_frame_whole(TImageRing* ring, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    TImageRingHeader* header = ring->header;
+    return __atomic_load_n(&header->slot_seqs[(seq - 1) % ring->layout.slot_count], __ATOMIC_RELAXED) == seq;
+}
+
+/**
+ * Draws the newest frame in the ring at playback->row, playback->column on fd each time there's a new one, scaled to fit
+ * display_width x display_height cells, until the producer closes the ring or playback->is_stopped is set.
+ * 
+ * Frames are converted where they are in the shared memory. Frames published while one is being drawn are
+ * skipped and counted in frames_dropped, along with frames the producer overwrote while they were being converted.
+ * 
+ * Returns 0 or -1 if writing failed (errno is set).
+ */
+int play_frame_ring(
+    TImageConverter* converter,
+    TImageRing* ring,
+    int display_width,
+    int display_height,
+    int fd,
+    TImagePlayback* playback
+) {
+    TImageRingHeader* header = ring->header;
+    TImageRingHeader* layout = &ring->layout;
+    size_t cell_count = (size_t)display_width * display_height;
+    TImagePackedCell* cells = malloc(cell_count * sizeof(TImagePackedCell));
+    if (cells == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    TImagePresenter* presenter = new_presenter(playback->row, playback->column);
+    TImageFrameBuffer* frame = new_frame_buffer();
+    int error = 0;
+    double start_ms = playback_now_ms();
+    uint32_t taken = 0; // seq of the last frame taken from the ring
+    uint32_t seen = 0; // seq of the frame on screen, 0 if its cells have to be converted from scratch
+    while (error == 0 && !is_playback_stopped(playback)) {
+        uint32_t seq = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+        if (seq == taken) {
+            if (__atomic_load_n(&header->is_closed, __ATOMIC_ACQUIRE)) break;
+            ring_wait(header, taken);
+            continue;
+        }
+        if (taken != 0) {
+            playback->frames_dropped += seq - taken - 1;
+        }
+        taken = seq;
+
+        TImagePixels pixels = image_pixels(ring_slot(ring, seq - 1), layout->width, layout->height, layout->format, layout->stride);
+        if (seen == 0) {
+            convert_pixels_to_packed_cells(converter, &pixels, display_width, display_height, cells);
+        }
+        else {
+            TImagePixels previous = image_pixels(ring_slot(ring, seen - 1), layout->width, layout->height, layout->format, layout->stride);
+            convert_pixels_changes(converter, &pixels, &previous, display_width, display_height, cells);
+        }
+
+        // the cells are only right if neither frame was overwritten meanwhile, otherwise start over with the newest
+        int is_whole = is_ring_frame_whole(ring, seq) && (seen == 0 || is_ring_frame_whole(ring, seen));
+        if (!is_whole) {
+            playback->frames_dropped++;
+            seen = 0;
+            continue;
+        }
+
+        if (playback->frames_shown == 0) {
+            start_ms = playback_now_ms();
+        }
+        frame_clear(frame);
+        presenter_present(presenter, cells, display_width, display_height, frame);
+        if (frame_write(frame, fd) != 0) {
+            error = errno;
+        }
+        playback->bytes_written += frame->len;
+        playback->frames_shown++;
+        seen = seq;
+    }
+    playback->seconds = (playback_now_ms() - start_ms) / 1000.0;
+
+    free(cells);
+    free_frame_buffer(frame);
+    free_presenter(presenter);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Redraws an image file in place whenever it changes, for things like plots that are written
+    again every few seconds.
+
+    The file's directory is watched with inotify rather than the file itself, as programs often
+    write a new file and rename it over the old one, which a watch on the old file would miss.
+    Changes are only acted on once there haven't been any for WATCH_SETTLE_MS, so a file being
+    written in pieces is read once it's done. A file that still can't be decoded (it's part
+    way through being written, or was removed) is counted in frames_dropped and the picture
+    on screen is left as it is until the next change. Only the cells that changed are sent
+    (see TImagePresenter), so a small change to the image costs a small amount of output.
+
+    frames_shown counts the times the image was drawn. With *display_height 0 the height is
+    worked out from the first image drawn (see display_height_for_width) and *display_height
+    is set to it, later images are fit in the same height so nothing is left below a shorter
+    one. Returns 0 once *playback->is_stopped is set, or -1 if the file can't be watched or
+    writing failed (errno is set).
+
+    Used like so:
+    ```
+    TImagePlayback playback = {0};
+    playback.row = 1;
+    playback.column = 1;
+    playback.is_stopped = &is_stopped; // set by a SIGINT handler
+    int height = 24;
+    watch_image(converter, "plot.png", 80, &height, STDOUT_FILENO, &playback);
+    ```
+*/
+#define WATCH_SETTLE_MS 100
+
+// converts path and draws what changed, returns -1 if writing failed
+static int draw_watched_image(
+    TImageConverter* converter,
+    char* path,
+    int display_width,
+    int* display_height,
+    TImagePresenter* presenter,
+    TImageFrameBuffer* frame,
+    int fd,
+    TImagePlayback* playback
+) {
+    const char* reason;
+    TImageLoaded* loaded = try_load_image(converter, path, display_width, *display_height > 0? *display_height : DISPLAY_HEIGHT_ANY, &reason);
+    if (loaded == NULL) {
+        playback->frames_dropped++;
+        return 0;
+    }
+    if (*display_height == 0) {
+        *display_height = display_height_for_width(loaded->pixels.width, loaded->pixels.height, display_width);
+    }
+    TImagePackedCell* cells = convert_pixels_to_packed_cells(converter, &loaded->pixels, display_width, *display_height, NULL);
+    free_loaded_image(loaded);
+
+    frame_clear(frame);
+    presenter_present(presenter, cells, display_width, *display_height, frame);
+    playback->bytes_written += frame->len;
+    playback->frames_shown++;
+    return frame_write(frame, fd);
+}
+
+#ifdef __linux__
+
+int watch_image(TImageConverter* converter, char* path, int display_width, int* display_height, int fd, TImagePlayback* playback) {
+
+    // watch the directory for changes to the file's name in it
+    char directory[PATH_MAX];
+    const char* slash = strrchr(path, '/');
+    const char* name = slash != NULL? slash + 1 : path;
+    if (slash == NULL) {
+        strcpy(directory, ".");
+    }
+    else if (slash == path) {
+        strcpy(directory, "/");
+    }
+    else {
+        if ((size_t)(slash - path) >= sizeof(directory)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(directory, path, slash - path);
+        directory[slash - path] = '\0';
+    }
+    int watcher = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher < 0) {
+        return -1;
+    }
+    if (inotify_add_watch(watcher, directory, IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE | IN_ATTRIB) < 0) {
+        int error = errno;
+        close(watcher);
+        errno = error;
+        return -1;
+    }
+
+    TImagePresenter* presenter = new_presenter(playback->row, playback->column);
+    TImageFrameBuffer* frame = new_frame_buffer();
+    double start_ms = playback_now_ms();
+    int error = 0;
+    if (draw_watched_image(converter, path, display_width, display_height, presenter, frame, fd, playback) != 0) {
+        error = errno;
+    }
+
+    // events are read into this, aligned for struct inotify_event
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    double changed_ms = -1; // when the last change came, -1 if there's none waiting to be drawn
+    while (error == 0 && !is_playback_stopped(playback)) {
+        int timeout = PLAYBACK_POLL_MS;
+        if (changed_ms >= 0) {
+            double settled_ms = changed_ms + WATCH_SETTLE_MS - playback_now_ms();
+            timeout = settled_ms > 0? (int)settled_ms + 1 : 0;
+            if (timeout > PLAYBACK_POLL_MS) timeout = PLAYBACK_POLL_MS;
+        }
+        struct pollfd readable = {watcher, POLLIN, 0};
+        int ready = poll(&readable, 1, timeout);
+        if (ready < 0 && errno != EINTR) {
+            error = errno;
+            break;
+        }
+
+        if (ready > 0) {
+            ssize_t len;
+            while ((len = read(watcher, events, sizeof(events))) > 0) {
+                for (char* at = events; at < events + len; ) {
+                    struct inotify_event* event = (struct inotify_event*)at;
+                    if (event->len > 0 && strcmp(event->name, name) == 0) {
+                        changed_ms = playback_now_ms();
+                    }
+                    at += sizeof(struct inotify_event) + event->len;
+                }
+            }
+        }
+        if (changed_ms >= 0 && playback_now_ms() - changed_ms >= WATCH_SETTLE_MS) {
+            changed_ms = -1;
+            if (draw_watched_image(converter, path, display_width, display_height, presenter, frame, fd, playback) != 0) {
+                error = errno;
+            }
+        }
+    }
+    playback->seconds = (playback_now_ms() - start_ms) / 1000.0;
+
+    free_frame_buffer(frame);
+    free_presenter(presenter);
+    close(watcher);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+#else
+
+int watch_image(TImageConverter* converter, char* path, int display_width, int* display_height, int fd, TImagePlayback* playback) {
+    (void)converter;
+    (void)path;
+    (void)display_width;
+    (void)display_height;
+    (void)fd;
+    (void)playback;
+    errno = ENOSYS; // inotify is linux only
+    return -1;
+}
+
+#endif
+
+/*
+    A server that converts images for other programs over a Unix domain socket, so a program
+    asking for lots of small previews doesn't pay for starting ti, building the glyph tables
+    and warming up its buffers every time.
+
+    Clients send a TImageServerRequest followed by length bytes: a path, the bytes of an image
+    file or raw pixels (height rows, stride bytes apart, in format). They get back a
+    TImageServerResponse followed by length bytes: the ansii output, display_width x
+    display_height packed cells (with SERVER_OPTION_CELLS) or a message saying why it failed.
+    A connection can send any number of requests, one after the other. Paths are opened by the
+    server so they should be absolute.
+
+    job_count jobs each have their own converter (made like settings) and serve one connection
+    at a time, more connections wait for a free job in the order they came. A connection with
+    no request coming goes back to the end of the line when others are waiting, and is closed
+    after SERVER_IDLE_SECONDS without a request (clients connect again after that). Results are kept in a cache of at most
+    cache_bytes bytes, the least recently used dropped first. Paths are cached by the file's
+    inode, size and modification time so a file that changed is converted again, and bytes by
+    a hash of them.
+
+    Used like so:
+    ```
+    TImageServer server = {0};
+    server.socket_path = "/tmp/ti.sock";
+    server.cache_bytes = 64 * 1024 * 1024;
+    server.is_stopped = &is_stopped; // set from a signal handler
+    serve_images(converter, &server);
+    ```
+
+    And in the client:
+    ```
+    int fd = connect_image_server("/tmp/ti.sock");
+    TImageServerRequest request = {0};
+    request.kind = SERVER_REQUEST_PATH;
+    request.display_width = 80;
+    request.display_height = 24;
+    request.length = strlen(path);
+    TImageServerResponse response;
+    char* body;
+    if (request_image(fd, &request, path, &response, &body) == 0 && response.status == 0) {
+        write(STDOUT_FILENO, body, response.length);
+    }
+    free(body);
+    close(fd);
+    ```
+*/
+#define SERVER_MAGIC 0x54495331 // TIS1
+
+#define SERVER_REQUEST_PATH 1
+#define SERVER_REQUEST_FILE 2
+#define SERVER_REQUEST_PIXELS 3
+
+#define SERVER_OPTION_CELLS 1 // packed cells instead of ansii output
+#define SERVER_OPTION_THUMBNAIL 2 // see is_thumbnail_used
+
+#define SERVER_MAX_DISPLAY 2048
+#define SERVER_MAX_REQUEST_BYTES ((uint64_t)1 << 30)
+#define SERVER_TIMEOUT_SECONDS 10 // for a client that stops part way through a request
+#define SERVER_IDLE_SECONDS 30 // for a client that keeps its connection open without sending requests
+
+typedef struct {
+    uint32_t magic;
+    uint32_t kind; // one of the SERVER_REQUEST_ values
+    uint32_t options; // SERVER_OPTION_ flags
+    int32_t display_width;
+    int32_t display_height; // 0 for as many rows as the image needs
+    int32_t width; // the pixels' size and layout for SERVER_REQUEST_PIXELS
+    int32_t height;
+    int32_t format;
+    uint64_t stride;
+    uint64_t length;
+} TImageServerRequest;
+
+typedef struct {
+    uint32_t magic;
+    int32_t status; // 0 or an errno
+    int32_t display_width; // the size it was converted at
+    int32_t display_height;
+    uint32_t is_cached;
+    uint32_t unused;
+    uint64_t length;
+} TImageServerResponse;
+
+typedef struct {
+    const char* socket_path;
+    int job_count; // 0 for one per cpu core
+    size_t cache_bytes;
+    volatile sig_atomic_t* is_stopped;
+
+    // counted while serving
+    long requests;
+    long cache_hits;
+} TImageServer;
+
+// what a result is cached by, every field is compared
+typedef struct {
+    uint64_t hash; // of the path or the bytes
+    uint64_t length;
+    uint64_t device;
+    uint64_t inode;
+    int64_t modified_seconds;
+    int64_t modified_nanoseconds;
+    uint32_t kind;
+    uint32_t options;
+    int32_t display_width;
+    int32_t display_height;
+    int32_t width;
+    int32_t height;
+    int32_t format;
+    uint32_t unused;
+    uint64_t stride;
+} TImageServerKey;
+
+typedef struct TImageServerResult {
+    TImageServerKey key;
+    char* data;
+    size_t len;
+    int display_width;
+    int display_height;
+    struct TImageServerResult* newer;
+    struct TImageServerResult* older;
+} TImageServerResult;
+
+typedef struct {
+    int fd;
+    double idle_since_ms; // when its last request was answered, see playback_now_ms
+} TImageServerConnection;
+
+typedef struct {
+    TImageConverter* settings;
+    TImageServer* server;
+    int listener;
+
+    // connections waiting for a job, oldest first from waiting_first (a ring of waiting_capacity)
+    TImageServerConnection* waiting;
+    int waiting_first;
+    int waiting_count;
+    int waiting_capacity;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    // the cache, newest first
+    TImageServerResult* newest;
+    TImageServerResult* oldest;
+    size_t cache_used;
+    pthread_mutex_t cache_lock;
+} TImageServerRun;
+
+static int is_server_stopped(TImageServer* server) {
+    return server->is_stopped != NULL && *server->is_stopped;
+}
+
+static uint64_t hash_bytes(const uint8_t* bytes, size_t len) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// reads len bytes, returns 0 or -1 if the connection ended first (errno 0) or reading failed (or timed out)
+static int read_all(int fd, void* data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t result = read(fd, (uint8_t*)data + done, len - done);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) {
+            if (result == 0) errno = 0;
+            return -1;
+        }
+        done += result;
+    }
+    return 0;
+}
+
+// writes len bytes, returns 0 or -1 if writing failed (errno is set)
+static int write_all(int fd, const void* data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t result = send(fd, (const uint8_t*)data + done, len - done, MSG_NOSIGNAL);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += result;
+    }
+    return 0;
+}
+
+// the cached result for key moved to the front, or NULL, cache_lock has to be held
+static TImageServerResult* find_server_result(TImageServerRun* run, TImageServerKey* key) {
+    TImageServerResult* result = run->newest;
+    while (result != NULL && memcmp(&result->key, key, sizeof(TImageServerKey)) != 0) {
+        result = result->older;
+    }
+    if (result == NULL || result == run->newest) return result;
+
+    // unlink and put it first
+    result->newer->older = result->older;
+    if (result->older != NULL) result->older->newer = result->newer;
+    else run->oldest = result->newer;
+    result->newer = NULL;
+    result->older = run->newest;
+    run->newest->newer = result;
+    run->newest = result;
+    return result;
+}
+
+static void drop_oldest_server_result(TImageServerRun* run) {
+    TImageServerResult* result = run->oldest;
+    run->oldest = result->newer;
+    if (run->oldest != NULL) run->oldest->older = NULL;
+    else run->newest = NULL;
+    run->cache_used -= result->len;
+    free(result->data);
+    free(result);
+}
+
+// keeps a copy of a result, dropping the oldest ones to make room
+static void cache_server_result(TImageServerRun* run, TImageServerKey* key, const char* data, size_t len, int display_width, int display_height) {
+    if (len > run->server->cache_bytes) return;
+
+    TImageServerResult* result = malloc(sizeof(TImageServerResult));
+    char* copy = malloc(len > 0? len : 1);
+    if (result == NULL || copy == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    memcpy(copy, data, len);
+    result->key = *key;
+    result->data = copy;
+    result->len = len;
+    result->display_width = display_width;
+    result->display_height = display_height;
+
+    pthread_mutex_lock(&run->cache_lock);
+    if (find_server_result(run, key) != NULL) {
+        // another job just made it too
+        pthread_mutex_unlock(&run->cache_lock);
+        free(copy);
+        free(result);
+        return;
+    }
+    while (run->newest != NULL && run->cache_used + len > run->server->cache_bytes) {
+        drop_oldest_server_result(run);
+    }
+    result->newer = NULL;
+    result->older = run->newest;
+    if (run->newest != NULL) run->newest->newer = result;
+    else run->oldest = result;
+    run->newest = result;
+    run->cache_used += len;
+    pthread_mutex_unlock(&run->cache_lock);
+}
+
+// the key a request is cached by, returns an errno if a path can't be looked at
+static int server_key(TImageServerRequest* request, const uint8_t* payload, TImageServerKey* key) {
+    memset(key, 0, sizeof(TImageServerKey));
+    key->kind = request->kind;
+    key->options = request->options;
+    key->display_width = request->display_width;
+    key->display_height = request->display_height;
+    key->length = request->length;
+    key->hash = hash_bytes(payload, request->length);
+    if (request->kind == SERVER_REQUEST_PIXELS) {
+        key->width = request->width;
+        key->height = request->height;
+        key->format = request->format;
+        key->stride = request->stride;
+    }
+    else if (request->kind == SERVER_REQUEST_PATH) {
+        struct stat status;
+        if (stat((const char*)payload, &status) != 0) {
+            return errno;
+        }
+        key->device = status.st_dev;
+        key->inode = status.st_ino;
+        key->length = status.st_size;
+        key->modified_seconds = status.st_mtim.tv_sec;
+        key->modified_nanoseconds = status.st_mtim.tv_nsec;
+    }
+    return 0;
+}
+
+// why a request can't be served, or NULL if it's fine
+static const char* check_server_request(TImageServerRequest* request) {
+    if (request->magic != SERVER_MAGIC) return "not a ti request";
+    if (request->kind < SERVER_REQUEST_PATH || request->kind > SERVER_REQUEST_PIXELS) return "unknown kind of request";
+    if (request->display_width < 1 || request->display_width > SERVER_MAX_DISPLAY) return "display_width out of range";
+    if (request->display_height < 0 || request->display_height > SERVER_MAX_DISPLAY) return "display_height out of range";
+    if (request->length > SERVER_MAX_REQUEST_BYTES) return "request too large";
+    if (request->kind == SERVER_REQUEST_PATH && (request->length == 0 || request->length >= PATH_MAX)) return "bad path length";
+    if (request->kind == SERVER_REQUEST_PIXELS) {
+        if (request->format < PIXEL_FORMAT_GRAY || request->format > PIXEL_FORMAT_BGRA) return "unknown pixel format";
+        if (request->width < 1 || request->height < 1) return "bad pixel size";
+        if (request->stride > SERVER_MAX_REQUEST_BYTES) return "stride too large";
+        if (request->stride < (uint64_t)request->width * pixel_format_bytes((TImagePixelFormat)request->format)) return "stride too small";
+        if (request->length < request->stride * (request->height - 1) + (uint64_t)request->width * pixel_format_bytes((TImagePixelFormat)request->format)) {
+            return "not enough pixels";
+        }
+    }
+    return NULL;
+}
+
+// converts a request into frame (ansii or cells), returns NULL or why it couldn't be
+static const char* convert_server_request(
+    TImageConverter* converter,
+    TImageFrameBuffer* frame,
+    TImageServerRequest* request,
+    uint8_t* payload,
+    int* display_width,
+    int* display_height
+) {
+    *display_width = request->display_width;
+    int fit_height = request->display_height > 0? request->display_height : DISPLAY_HEIGHT_ANY;
+
+    const char* reason = NULL;
+    TImageLoaded* loaded = NULL;
+    uint8_t* decoded = NULL;
+    TImagePixels pixels;
+    if (request->kind == SERVER_REQUEST_PATH) {
+        loaded = try_load_image(converter, (char*)payload, *display_width, fit_height, &reason);
+        if (loaded == NULL) return reason;
+        pixels = loaded->pixels;
+    }
+    else if (request->kind == SERVER_REQUEST_FILE) {
+        int width, height, channels;
+        decoded = decode_image(converter, payload, request->length, *display_width, fit_height, &width, &height, &channels);
+        if (decoded == NULL) return stbi_failure_reason();
+        pixels = image_pixels(decoded, width, height, (TImagePixelFormat)channels, 0);
+    }
+    else {
+        pixels = image_pixels(payload, request->width, request->height, (TImagePixelFormat)request->format, request->stride);
+    }
+
+    *display_height = request->display_height;
+    if (*display_height == 0) {
+        *display_height = display_height_for_width(pixels.width, pixels.height, *display_width);
+        if (*display_height > SERVER_MAX_DISPLAY) *display_height = SERVER_MAX_DISPLAY;
+    }
+    TImagePackedCell* cells = convert_pixels_to_packed_cells(converter, &pixels, *display_width, *display_height, NULL);
+    frame_clear(frame);
+    if (request->options & SERVER_OPTION_CELLS) {
+        frame_append(frame, (const char*)cells, (size_t)*display_width * *display_height * sizeof(TImagePackedCell));
+    }
+    else {
+        frame_append_cells(frame, cells, *display_width, *display_height);
+    }
+
+    if (loaded != NULL) free_loaded_image(loaded);
+    stbi_image_free(decoded);
+    return NULL;
+}
+
+static int send_server_response(int fd, int status, int display_width, int display_height, int is_cached, const char* data, size_t len) {
+    TImageServerResponse response;
+    memset(&response, 0, sizeof(response));
+    response.magic = SERVER_MAGIC;
+    response.status = status;
+    response.display_width = display_width;
+    response.display_height = display_height;
+    response.is_cached = is_cached;
+    response.length = len;
+    if (write_all(fd, &response, sizeof(response)) != 0) return -1;
+    return write_all(fd, data, len);
+}
+
+// serves requests from one connection until it's closed, returns -1 if it should be closed because of an error
+static int serve_request(TImageServerRun* run, TImageConverter* converter, TImageFrameBuffer* frame, int fd, uint8_t** payload, size_t* capacity) {
+    TImageServerRequest request;
+    if (read_all(fd, &request, sizeof(request)) != 0) return -1;
+    const char* problem = check_server_request(&request);
+    if (problem != NULL) {
+        send_server_response(fd, EINVAL, 0, 0, 0, problem, strlen(problem));
+        return -1;
+    }
+
+    // room for a 0 after a path
+    *payload = grow_buffer(*payload, capacity, request.length + 1);
+    if (read_all(fd, *payload, request.length) != 0) return -1;
+    (*payload)[request.length] = '\0';
+    __atomic_add_fetch(&run->server->requests, 1, __ATOMIC_RELAXED);
+
+    TImageServerKey key;
+    int status = server_key(&request, *payload, &key);
+    if (status != 0) {
+        const char* reason = strerror(status);
+        return send_server_response(fd, status, 0, 0, 0, reason, strlen(reason));
+    }
+
+    // send a cached result while holding the lock, so it can't be dropped part way through
+    pthread_mutex_lock(&run->cache_lock);
+    TImageServerResult* result = find_server_result(run, &key);
+    if (result != NULL) {
+        __atomic_add_fetch(&run->server->cache_hits, 1, __ATOMIC_RELAXED);
+        frame_clear(frame);
+        frame_append(frame, result->data, result->len);
+        int display_width = result->display_width;
+        int display_height = result->display_height;
+        pthread_mutex_unlock(&run->cache_lock);
+        return send_server_response(fd, 0, display_width, display_height, 1, frame->data, frame->len);
+    }
+    pthread_mutex_unlock(&run->cache_lock);
+
+    converter->is_thumbnail_used = run->settings->is_thumbnail_used || (request.options & SERVER_OPTION_THUMBNAIL) != 0;
+    int display_width = 0;
+    int display_height = 0;
+    const char* reason = convert_server_request(converter, frame, &request, *payload, &display_width, &display_height);
+    if (reason != NULL) {
+        return send_server_response(fd, EINVAL, 0, 0, 0, reason, strlen(reason));
+    }
+    cache_server_result(run, &key, frame->data, frame->len, display_width, display_height);
+    return send_server_response(fd, 0, display_width, display_height, 0, frame->data, frame->len);
+}
+
+// puts a connection at the end of the line for a job, lock has to be held
+static void push_server_connection(TImageServerRun* run, TImageServerConnection connection) {
+    if (run->waiting_count == run->waiting_capacity) {
+        int capacity = run->waiting_capacity == 0? 16 : run->waiting_capacity * 2;
+        TImageServerConnection* waiting = malloc(capacity * sizeof(TImageServerConnection));
+        if (waiting == NULL) {
+            converter_mem_error_exit_failing();
+        }
+        for (int i = 0; i < run->waiting_count; ++i) {
+            waiting[i] = run->waiting[(run->waiting_first + i) % run->waiting_capacity];
+        }
+        free(run->waiting);
+        run->waiting = waiting;
+        run->waiting_first = 0;
+        run->waiting_capacity = capacity;
+    }
+    run->waiting[(run->waiting_first + run->waiting_count) % run->waiting_capacity] = connection;
+    run->waiting_count++;
+    pthread_cond_signal(&run->changed);
+}
+
+// takes the connection that's waited longest, lock has to be held and one has to be waiting
+static TImageServerConnection take_server_connection(TImageServerRun* run) {
+    TImageServerConnection connection = run->waiting[run->waiting_first];
+    run->waiting_first = (run->waiting_first + 1) % run->waiting_capacity;
+    run->waiting_count--;
+    return connection;
+}
+
+static void* server_job(void* arg) {
+    TImageServerRun* run = arg;
+    TImageConverter* converter = new_job_converter(run->settings);
+    TImageFrameBuffer* frame = new_frame_buffer();
+    uint8_t* payload = NULL;
+    size_t capacity = 0;
+
+    pthread_mutex_lock(&run->lock);
+    while (!is_server_stopped(run->server)) {
+        if (run->waiting_count == 0) {
+            poll_wait(&run->changed, &run->lock);
+            continue;
+        }
+        TImageServerConnection connection = take_server_connection(run);
+        pthread_mutex_unlock(&run->lock);
+
+        // one request after another until the client closes the connection, stops sending them for
+        // SERVER_IDLE_SECONDS or has nothing to send while other connections are waiting (or ti is stopped)
+        int is_closed = 1;
+        while (!is_server_stopped(run->server)) {
+            struct pollfd readable = {connection.fd, POLLIN, 0};
+            int ready = poll(&readable, 1, PLAYBACK_POLL_MS);
+            if (ready < 0 && errno != EINTR) break;
+            if (ready > 0) {
+                if (serve_request(run, converter, frame, connection.fd, &payload, &capacity) != 0) break;
+                connection.idle_since_ms = playback_now_ms();
+                continue;
+            }
+            if (playback_now_ms() - connection.idle_since_ms > SERVER_IDLE_SECONDS * 1000.0) break;
+            pthread_mutex_lock(&run->lock);
+            int is_line = run->waiting_count > 0;
+            pthread_mutex_unlock(&run->lock);
+            if (is_line) {
+                is_closed = 0;
+                break;
+            }
+        }
+
+        if (is_closed) {
+            close(connection.fd);
+            pthread_mutex_lock(&run->lock);
+        }
+        else {
+            pthread_mutex_lock(&run->lock);
+            push_server_connection(run, connection);
+        }
+    }
+    pthread_mutex_unlock(&run->lock);
+
+    free(payload);
+    free_frame_buffer(frame);
+    free_image_converter(converter);
+    return NULL;
+}
+
+static void* server_jobs(void* arg) {
+    TImageServerRun* run = arg;
+    int job_count = run->server->job_count;
+    run_jobs(server_job, run, job_count, job_count > 0? job_count : INT_MAX);
+    return NULL;
+}
+
+/**
+ * Serves images on server->socket_path (see TImageServer) with the options set on settings, until
+ * *server->is_stopped is set. Returns 0, or -1 if the socket couldn't be made (errno is set).
+ */
+int serve_images(TImageConverter* settings, TImageServer* server) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(server->socket_path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, server->socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        return -1;
+    }
+    unlink(server->socket_path); // left over from a server that didn't stop cleanly
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        int error = errno;
+        close(listener);
+        errno = error;
+        return -1;
+    }
+
+    TImageServerRun run;
+    memset(&run, 0, sizeof(run));
+    run.settings = settings;
+    run.server = server;
+    run.listener = listener;
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.changed, NULL);
+    pthread_mutex_init(&run.cache_lock, NULL);
+
+    pthread_t jobs;
+    if (pthread_create(&jobs, NULL, server_jobs, &run) != 0) {
+        fprintf(stderr, "Failed to start the server jobs. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+
+    while (!is_server_stopped(server)) {
+        struct pollfd readable = {listener, POLLIN, 0};
+        if (poll(&readable, 1, PLAYBACK_POLL_MS) <= 0) continue;
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) continue;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        struct timeval timeout = {SERVER_TIMEOUT_SECONDS, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        TImageServerConnection connection = {fd, playback_now_ms()};
+        pthread_mutex_lock(&run.lock);
+        push_server_connection(&run, connection);
+        pthread_mutex_unlock(&run.lock);
+    }
+
+    pthread_mutex_lock(&run.lock);
+    pthread_cond_broadcast(&run.changed);
+    pthread_mutex_unlock(&run.lock);
+    pthread_join(jobs, NULL);
+
+    close(listener);
+    unlink(server->socket_path);
+    while (run.waiting_count > 0) {
+        close(take_server_connection(&run).fd);
+    }
+    free(run.waiting);
+    while (run.newest != NULL) {
+        drop_oldest_server_result(&run);
+    }
+    pthread_mutex_destroy(&run.cache_lock);
+    pthread_cond_destroy(&run.changed);
+    pthread_mutex_destroy(&run.lock);
+    return 0;
+}
+
+/**
+ * Connects to a server started with serve_images, returns the connection or -1 (errno is set).
+ */
+int connect_image_server(const char* socket_path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Sends request (its magic is filled in) and request->length bytes of payload to the server, and reads back
+ * its response and response->length bytes of body (free it when done). Returns 0, or -1 if sending or
+ * receiving failed (errno is set, 0 if the server closed the connection).
+ */
+int request_image(int fd, TImageServerRequest* request, const void* payload, TImageServerResponse* response, char** body) {
+    *body = NULL;
+    request->magic = SERVER_MAGIC;
+    if (write_all(fd, request, sizeof(TImageServerRequest)) != 0 || write_all(fd, payload, request->length) != 0) {
+        return -1;
+    }
+    if (read_all(fd, response, sizeof(TImageServerResponse)) != 0) {
+        return -1;
+    }
+    if (response->magic != SERVER_MAGIC || response->length > SERVER_MAX_REQUEST_BYTES) {
+        errno = EPROTO;
+        return -1;
+    }
+    *body = malloc(response->length + 1);
+    if (*body == NULL) {
+        converter_mem_error_exit_failing();
+    }
+    if (read_all(fd, *body, response->length) != 0) {
+        int error = errno;
+        free(*body);
+        *body = NULL;
+        errno = error;
+        return -1;
+    }
+    (*body)[response->length] = '\0';
+    return 0;
+}
+
+
+/**
+ * Converts an image file to an array of cells containing the ansii color codes and unicode characters. 
+ * This 1d array can be printed adding a newline every display_width cells to display the image in the terminal.
+ * 
+ * If the image size won't fit perfectly in display_width x display_height cells, then the image will be scaled
+ * to fit in the area (but not distorted).
+ * 
+ * You can call the free_image_cells method above to clean up the output of this function after you're done with it.
+ * 
+ * If you're converting more than one image use a TImageConverter instead, which avoids rebuilding everything each call.
+ */
+TImageCell** convert_image_to_ansii_cells(char* path, int display_width, int display_height) {
+
+    TImageConverter* converter = new_image_converter();
+    TImageCell** converter_cells = convert_image_with_converter(converter, path, display_width, display_height);
+
+    // copy out of the converter so the cells outlive it and can be freed with free_image_cells
+    TImageCell** cells = calloc(display_height * display_width, sizeof(TImageCell*));
+    for (int i = 0; i < display_width * display_height; ++i) {
+        if (converter_cells[i] != NULL) {
+            TImageCell* cell = malloc(sizeof(TImageCell));
+            *cell = *converter_cells[i];
+            cell->unicode = strdup(converter_cells[i]->unicode);
+            cells[i] = cell;
+        }
+    }
+    free_image_converter(converter);
+
+    return cells;
+}
+
+#endif
@@ -1,8 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <stdint.h>
 #include <string.h>
+#include <signal.h>
+#include <dirent.h>
 #include <sys/ioctl.h>
+#include <termios.h>
 #include <unistd.h>
 
 
@@ -17,106 +21,752 @@ leaks -atExit -- ./ti test/wizards.jpg
 
 */
 
-void set_terminal_color_rgb(int fr, int fg, int fb, int br, int bg, int bb) {
-    // Foreground (text) = 38;2;r;g;b
-    // Background         = 48;2;r;g;b
-    printf("\033[38;2;%d;%d;%dm", fr, fg, fb);
-    printf("\033[48;2;%d;%d;%dm", br, bg, bb);
+static volatile sig_atomic_t is_stopped = 0;
+
+static void stop_playing(int signal) {
+    (void)signal;
+    is_stopped = 1;
 }
 
-void ansii_reset() {
-    printf("\033[0m");
+// clears the screen for playing something in place, ctrl-c stops it
+static TImagePlayback start_playing() {
+    signal(SIGINT, stop_playing);
+    printf("\033[2J\033[?25l"); // clear the screen and hide the cursor
+    fflush(stdout);
+
+    TImagePlayback playback = {0};
+    playback.row = 1;
+    playback.column = 1;
+    playback.is_stopped = &is_stopped;
+    return playback;
 }
 
+// shows the cursor again below what was played
+static void end_playing(int terminal_height) {
+    printf("\033[?25h\033[%d;1H\n", terminal_height + 1);
+}
 
-int main(int argc, char **argv) {
-    if (argc < 2 || argv[1] == NULL) {
-        printf("%sPlease provide a single path to and image file you'd like to display%s", RED, RESET);
+// plays an animated gif until ctrl-c, returns what main returns
+static int play(TImageConverter* converter, char* path, int terminal_width, int terminal_height, int info) {
+    TImageInput* input = open_image_input(path);
+    if (input == NULL) {
+        printf("Failed to load image: %s\n", strerror(errno));
         exit(-1);
     }
+    TImageAnimation* animation = new_gif_animation(input->data, input->len);
+    if (animation == NULL) {
+        printf("Failed to load image: %s\n", stbi_failure_reason());
+        exit(-1);
+    }
+    if (terminal_height == 0) {
+        terminal_height = display_height_for_width(animation->width, animation->height, terminal_width);
+    }
 
+    TImagePlayback playback = start_playing();
+    int result = play_animation(converter, animation, terminal_width, terminal_height, STDOUT_FILENO, &playback);
+    end_playing(terminal_height);
+    if (result != 0) {
+        perror("write");
+        return 1;
+    }
+    if (info) {
+        printf("image_width %d\n", animation->width);
+        printf("image_height %d\n", animation->height);
+        printf("frames %d\n", animation->frame_count);
+        printf("size %.2f MB\n", (double)input->len / (1000.0 * 1000.0));
+        printf("shown %d frames (%d late), output %zu bytes\n", playback.frames_shown, playback.frames_late, playback.bytes_written);
+    }
 
-    // get file path
-    char* path;
+    free_animation(animation);
+    close_image_input(input);
+    return 0;
+}
 
-    int info = 0;
-    if (argc > 2) {
-        char* flag = argv[1];
-        info = strcmp(flag, "-i") == 0;
-        path = argv[2];
+// redraws the image each time the file changes until ctrl-c, returns what main returns
+static int watch(TImageConverter* converter, char* path, int terminal_width, int terminal_height, int info) {
+    TImagePlayback playback = start_playing();
+    int result = watch_image(converter, path, terminal_width, &terminal_height, STDOUT_FILENO, &playback);
+    end_playing(terminal_height);
+    if (result != 0) {
+        perror("watch");
+        return 1;
+    }
+    if (info) {
+        printf("drawn %d times (%d changes couldn't be read), output %zu bytes\n", playback.frames_shown, playback.frames_dropped, playback.bytes_written);
+    }
+    return 0;
+}
+
+// plays raw video frames from stdin until they end or ctrl-c, returns what main returns
+static int play_video(
+    TImageConverter* converter,
+    int frame_width,
+    int frame_height,
+    TImagePixelFormat format,
+    int terminal_width,
+    int terminal_height
+) {
+    if (terminal_height == 0) {
+        terminal_height = display_height_for_width(frame_width, frame_height, terminal_width);
+    }
+    TImagePlayback playback = start_playing();
+    int result = play_raw_video(
+        converter,
+        STDIN_FILENO,
+        frame_width,
+        frame_height,
+        format,
+        terminal_width,
+        terminal_height,
+        STDOUT_FILENO,
+        &playback
+    );
+    end_playing(terminal_height);
+    if (result != 0) {
+        perror("video");
+        return 1;
+    }
+    double fps = playback.seconds > 0? playback.frames_shown / playback.seconds : 0;
+    printf("shown %d frames at %.1f fps, dropped %d\n", playback.frames_shown, fps, playback.frames_dropped);
+    return 0;
+}
+
+// draws the newest frame from a shared memory ring each time there's a new one, returns what main returns
+static int play_ring(TImageConverter* converter, char* name, int terminal_width, int terminal_height) {
+    TImageRing* ring = open_frame_ring(name);
+    if (ring == NULL) {
+        printf("Failed to open frame ring %s: %s\n", name, strerror(errno));
+        exit(-1);
+    }
+    if (terminal_height == 0) {
+        terminal_height = display_height_for_width(ring->layout.width, ring->layout.height, terminal_width);
+    }
+
+    TImagePlayback playback = start_playing();
+    int result = play_frame_ring(converter, ring, terminal_width, terminal_height, STDOUT_FILENO, &playback);
+    end_playing(terminal_height);
+    close_frame_ring(ring);
+    if (result != 0) {
+        perror("write");
+        return 1;
+    }
+    double fps = playback.seconds > 0? playback.frames_shown / playback.seconds : 0;
+    printf("shown %d frames at %.1f fps, dropped %d\n", playback.frames_shown, fps, playback.frames_dropped);
+    return 0;
+}
+
+// files in a directory that look like images, by their extension
+static int is_image_name(const char* name) {
+    const char* extensions[] = {".jpg", ".jpeg", ".png", ".bmp", ".gif", ".tga", ".psd", ".pic", ".pnm", ".ppm", ".pgm", ".hdr"};
+    const char* extension = strrchr(name, '.');
+    if (extension == NULL || name[0] == '.') return 0;
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i) {
+        if (strcasecmp(extension, extensions[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void add_path(char*** paths, int* count, int* capacity, char* path) {
+    if (*count == *capacity) {
+        *capacity = *capacity == 0? 64 : *capacity * 2;
+        *paths = realloc(*paths, *capacity * sizeof(char*));
+        if (*paths == NULL) {
+            fprintf(stderr, "Failed to allocate memory for the list of images. Exiting...");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*paths)[(*count)++] = path;
+}
+
+// the images in a directory, or listed one per line in a file ("-" for stdin), sorted
+static char** batch_paths(char* path, int* count) {
+    char** paths = NULL;
+    int capacity = 0;
+    *count = 0;
+
+    DIR* directory = strcmp(path, "-") == 0? NULL : opendir(path);
+    if (directory != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(directory)) != NULL) {
+            if (!is_image_name(entry->d_name)) continue;
+            char* image_path = malloc(strlen(path) + strlen(entry->d_name) + 2);
+            sprintf(image_path, "%s/%s", path, entry->d_name);
+            add_path(&paths, count, &capacity, image_path);
+        }
+        closedir(directory);
     }
     else {
-        path = argv[1];
+        FILE* list = strcmp(path, "-") == 0? stdin : fopen(path, "r");
+        if (list == NULL) {
+            printf("Failed to read the list of images %s: %s\n", path, strerror(errno));
+            exit(-1);
+        }
+        char* line = NULL;
+        size_t line_capacity = 0;
+        ssize_t length;
+        while ((length = getline(&line, &line_capacity, list)) > 0) {
+            while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) line[--length] = '\0';
+            if (length > 0) add_path(&paths, count, &capacity, strdup(line));
+        }
+        free(line);
+        if (list != stdin) fclose(list);
+    }
+    qsort(paths, *count, sizeof(char*), compare_paths);
+    return paths;
+}
+
+// converts a batch of images to .ans files, returns what main returns
+static int convert_batch(TImageConverter* converter, char* path, int job_count, char* output_directory, int cols, int rows) {
+    if (cols <= 0) {
+        printf("%sPlease give the size to convert the images to with --cols (and --rows)%s\n", RED, RESET);
+        exit(-1);
+    }
+    int path_count;
+    char** paths = batch_paths(path, &path_count);
+
+    TImageBatch batch = {0};
+    batch.display_width = cols;
+    batch.display_height = rows;
+    batch.job_count = job_count;
+    batch.output_directory = output_directory;
+    convert_image_batch(converter, paths, path_count, &batch);
+
+    double images_per_second = batch.seconds > 0? batch.converted / batch.seconds : 0;
+    printf(
+        "converted %d images (%d failed) in %.2f s, %.1f images/sec, output %zu bytes\n",
+        batch.converted,
+        batch.failed,
+        batch.seconds,
+        images_per_second,
+        batch.bytes_written
+    );
+    for (int i = 0; i < path_count; ++i) {
+        free(paths[i]);
+    }
+    free(paths);
+    return batch.failed > 0? 1 : 0;
+}
+
+// draws the images as a grid of thumbnails, returns what main returns
+static int show_grid(TImageConverter* converter, char* path, int columns, int job_count, int terminal_width, int terminal_height, int info) {
+    int path_count;
+    char** paths = batch_paths(path, &path_count);
+    if (path_count == 0) {
+        printf("%sThere are no images in %s%s\n", RED, path, RESET);
+        exit(-1);
     }
 
-    // get window size
+    TImageGrid grid = {0};
+    grid.display_width = terminal_width;
+    grid.display_height = terminal_height;
+    grid.columns = columns;
+    grid.job_count = job_count;
+    TImagePackedCell* cells = convert_image_grid(converter, paths, path_count, &grid);
+    if (cells == NULL) {
+        printf("%sThere are too many images (%d) to fit in %dx%d cells%s\n", RED, path_count, terminal_width, terminal_height, RESET);
+        exit(-1);
+    }
+
+    // print the whole sheet with one write
+    TImageFrameBuffer* frame = new_frame_buffer();
+    frame_append_cells(frame, cells, grid.display_width, grid.display_height);
+    int result = frame_write(frame, STDOUT_FILENO);
+    if (result != 0) {
+        perror("write");
+    }
+    else if (info) {
+        double images_per_second = grid.seconds > 0? grid.converted / grid.seconds : 0;
+        printf(
+            "converted %d images (%d failed) in %.2f s, %.1f images/sec, %dx%d tiles of %dx%d cells, output %zu bytes\n",
+            grid.converted,
+            grid.failed,
+            grid.seconds,
+            images_per_second,
+            grid.columns,
+            grid.rows,
+            grid.tile_width,
+            grid.tile_height,
+            frame->len
+        );
+    }
+
+    free_frame_buffer(frame);
+    free(cells);
+    for (int i = 0; i < path_count; ++i) {
+        free(paths[i]);
+    }
+    free(paths);
+    return result != 0? 1 : 0;
+}
+
+static volatile sig_atomic_t is_resized = 0;
+static struct termios saved_terminal;
+
+static void resize_slides(int signal) {
+    (void)signal;
+    is_resized = 1;
+}
+
+// reads keys as they're pressed without echoing them, ctrl-c and resizing the terminal interrupt the read
+static void start_reading_keys() {
+    struct sigaction action = {0};
+    action.sa_handler = stop_playing;
+    sigaction(SIGINT, &action, NULL);
+    action.sa_handler = resize_slides;
+    sigaction(SIGWINCH, &action, NULL);
+
+    tcgetattr(STDIN_FILENO, &saved_terminal);
+    struct termios terminal = saved_terminal;
+    terminal.c_lflag &= ~(ICANON | ECHO);
+    terminal.c_cc[VMIN] = 1;
+    terminal.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &terminal);
+}
+
+static void stop_reading_keys() {
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved_terminal);
+}
+
+// waits for keys and adds how many slides they move by to step (keys pressed while a slide was
+// being drawn all come at once), returns 1 to quit
+static int read_slide_keys(int* step) {
+    unsigned char keys[64];
+    ssize_t len = read(STDIN_FILENO, keys, sizeof(keys));
+    if (len <= 0) {
+        return is_stopped || (len < 0 && errno != EINTR);
+    }
+    for (ssize_t i = 0; i < len; ++i) {
+        if (keys[i] == '\033' && i + 2 < len && keys[i + 1] == '[') {
+            char key = keys[i + 2];
+            if (key == 'C' || key == 'B' || key == '6') *step += 1; // right, down, page down
+            if (key == 'D' || key == 'A' || key == '5') *step -= 1; // left, up, page up
+            i += 2;
+            while (i + 1 < len && keys[i] >= '0' && keys[i] <= '9') i++; // the ~ after page up and down
+            continue;
+        }
+        switch (keys[i]) {
+            case ' ': case 'n': case 'l': case 'j': *step += 1; break;
+            case 127: case 'p': case 'h': case 'k': *step -= 1; break;
+            case 'q': case '\033': return 1;
+        }
+    }
+    return 0;
+}
+
+// the size to draw slides at, leaving the bottom row for the name of the image
+static void slide_size(int cols, int rows, int* width, int* height) {
     struct winsize w;
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == -1) {
-        perror("ioctl");
+    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+    *width = cols > 0? cols : w.ws_col - 2;
+    *height = rows > 0? rows : w.ws_row - 2;
+}
+
+// shows the images one at a time, flipping through them with the arrow keys, returns what main returns
+static int show_slides(TImageConverter* converter, char* path, int cols, int rows, size_t memory_cap, int info) {
+    int path_count;
+    char** paths = batch_paths(path, &path_count);
+    if (path_count == 0) {
+        printf("%sThere are no images in %s%s\n", RED, path, RESET);
+        exit(-1);
+    }
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "%sThe slideshow needs a terminal to read keys from and draw in%s\n", RED, RESET);
+        exit(-1);
+    }
+
+    int width, height;
+    slide_size(cols, rows, &width, &height);
+    TImageSlideshow* slideshow = new_slideshow(converter, paths, path_count, width, height, memory_cap);
+    TImageFrameBuffer* frame = new_frame_buffer();
+    start_reading_keys();
+    printf("\033[2J\033[?25l"); // clear the screen and hide the cursor
+    fflush(stdout);
+
+    int index = 0;
+    int is_quit = 0;
+    int result = 0;
+    while (!is_quit && result == 0) {
+        if (is_resized) {
+            is_resized = 0;
+            slide_size(cols, rows, &width, &height);
+            slideshow_resize(slideshow, width, height);
+            frame_clear(frame);
+            frame_append(frame, "\033[2J", 4);
+            result = frame_write(frame, STDOUT_FILENO);
+        }
+
+        double start_ms = playback_now_ms();
+        size_t len;
+        const char* reason;
+        const char* output = slideshow_slide(slideshow, index, &len, &reason);
+        char status[512];
+        if (output != NULL) {
+            snprintf(status, sizeof(status), "[%d/%d] %s (%.0f ms)", index + 1, path_count, paths[index], playback_now_ms() - start_ms);
+        }
+        else {
+            snprintf(status, sizeof(status), "[%d/%d] Failed to load %s: %s", index + 1, path_count, paths[index], reason);
+        }
+        if ((int)strlen(status) > width) status[width] = '\0';
+
+        // the slide and its name below it with one write
+        frame_clear(frame);
+        frame_append_cursor(frame, 1, 1);
+        if (output != NULL) {
+            frame_append(frame, output, len);
+        }
+        else {
+            frame_append(frame, "\033[J", 3);
+            frame_append_cursor(frame, height + 1, 1);
+        }
+        frame_append(frame, "\033[K", 3);
+        frame_append(frame, status, strlen(status));
+        if (result == 0) {
+            result = frame_write(frame, STDOUT_FILENO);
+        }
+
+        int step = 0;
+        is_quit = read_slide_keys(&step);
+        index = ((index + step) % path_count + path_count) % path_count;
+    }
+
+    stop_reading_keys();
+    printf("\033[?25h\n");
+    if (result != 0) {
+        perror("write");
+    }
+    else if (info) {
+        printf(
+            "shown %d slides, %d already converted, %d converted while waiting\n",
+            slideshow->slides_ready + slideshow->slides_converted,
+            slideshow->slides_ready,
+            slideshow->slides_converted
+        );
+    }
+    free_frame_buffer(frame);
+    free_slideshow(slideshow);
+    for (int i = 0; i < path_count; ++i) {
+        free(paths[i]);
+    }
+    free(paths);
+    return result != 0? 1 : 0;
+}
+
+// serves images on a unix socket until ctrl-c, returns what main returns
+static int serve(TImageConverter* converter, char* socket_path, int job_count, size_t cache_bytes) {
+    signal(SIGINT, stop_playing);
+    signal(SIGTERM, stop_playing);
+
+    TImageServer server = {0};
+    server.socket_path = socket_path;
+    server.job_count = job_count;
+    server.cache_bytes = cache_bytes;
+    server.is_stopped = &is_stopped;
+    printf("serving images on %s\n", socket_path);
+    fflush(stdout);
+    if (serve_images(converter, &server) != 0) {
+        printf("Failed to serve images on %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+    printf("served %ld requests, %ld from the cache\n", server.requests, server.cache_hits);
+    return 0;
+}
+
+// has a server started with --serve convert the image, returns what main returns
+static int request(char* socket_path, char* path, int terminal_width, int terminal_height, int is_thumbnail_used, int info) {
+    int fd = connect_image_server(socket_path);
+    if (fd < 0) {
+        printf("Failed to connect to the server on %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+
+    TImageServerRequest request = {0};
+    request.display_width = terminal_width;
+    request.display_height = terminal_height;
+    request.options = is_thumbnail_used? SERVER_OPTION_THUMBNAIL : 0;
+
+    // the server opens files itself, stdin is sent to it
+    char full_path[PATH_MAX];
+    TImageInput* input = NULL;
+    const void* payload;
+    if (strcmp(path, "-") == 0) {
+        input = open_image_input(path);
+        if (input == NULL) {
+            printf("Failed to load image: %s\n", strerror(errno));
+            exit(-1);
+        }
+        request.kind = SERVER_REQUEST_FILE;
+        request.length = input->len;
+        payload = input->data;
+    }
+    else {
+        if (realpath(path, full_path) == NULL) {
+            printf("Failed to load image: %s\n", strerror(errno));
+            exit(-1);
+        }
+        request.kind = SERVER_REQUEST_PATH;
+        request.length = strlen(full_path);
+        payload = full_path;
+    }
+
+    TImageServerResponse response;
+    char* body;
+    int result = request_image(fd, &request, payload, &response, &body);
+    close(fd);
+    if (input != NULL) {
+        close_image_input(input);
+    }
+    if (result != 0) {
+        printf("Failed to get the image from the server: %s\n", errno != 0? strerror(errno) : "the connection was closed");
         return 1;
     }
-    int terminal_width = w.ws_col - 2;
-    int terminal_height = w.ws_row - 2;
+    if (response.status != 0) {
+        printf("Failed to load image: %s\n", body);
+        free(body);
+        exit(-1);
+    }
 
+    fwrite(body, 1, response.length, stdout);
     if (info) {
-        terminal_height -= 4;
-    }
-
-    TImageCell** cells = convert_image_to_ansii_cells(path, terminal_width, terminal_height);
-    for (int y = 0; y < terminal_height; ++y) {
-        for (int x = 0; x < terminal_width; ++x) {
-
-            int i = x + y * terminal_width;
-            TImageCell* cell = cells[i];
-
-            if (cell != NULL) {
-                set_terminal_color_rgb(
-                    cell->text_color.r,
-                    cell->text_color.g,
-                    cell->text_color.b,
-                    cell->background_color.r,
-                    cell->background_color.g,
-                    cell->background_color.b
-                );
-                printf(cell->unicode);
-            }
-            else {
-                ansii_reset();
-                printf(" ");
+        printf("output %llu bytes at %dx%d%s\n", (unsigned long long)response.length, response.display_width, response.display_height, response.is_cached? " (cached)" : "");
+    }
+    free(body);
+    return 0;
+}
+
+// the pixel format named by -f, exits if there's no such format
+static TImagePixelFormat pixel_format_named(char* name) {
+    const char* names[] = {"", "gray", "graya", "rgb", "rgba", "bgr", "bgra"};
+    for (int format = PIXEL_FORMAT_GRAY; format <= PIXEL_FORMAT_BGRA; ++format) {
+        if (strcmp(name, names[format]) == 0) {
+            return (TImagePixelFormat)format;
+        }
+    }
+    printf("%sUnknown pixel format %s, use one of gray, graya, rgb, rgba, bgr or bgra%s\n", RED, name, RESET);
+    exit(-1);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argv[1] == NULL) {
+        printf("%sPlease provide a single path to and image file you'd like to display%s", RED, RESET);
+        exit(-1);
+    }
+
+
+    // get flags and file path
+    char* path = NULL;
+    int info = 0;
+    int thread_count = 0;
+    int is_streaming = 0;
+    int is_thumbnail_used = 0;
+    int is_animated = 0;
+    int is_watched = 0;
+    int video_width = 0;
+    int video_height = 0;
+    TImagePixelFormat video_format = PIXEL_FORMAT_RGBA;
+    char* ring_name = NULL;
+    char* batch_path = NULL;
+    char* grid_path = NULL;
+    char* slides_path = NULL;
+    char* serve_path = NULL;
+    char* server_path = NULL;
+    int cache_mb = 64;
+    int grid_columns = 0;
+    char* output_directory = ".";
+    int job_count = 0;
+    int cols = 0;
+    int rows = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-i") == 0) {
+            info = 1;
+        }
+        else if (strcmp(argv[i], "-s") == 0) {
+            is_streaming = 1;
+        }
+        else if (strcmp(argv[i], "-p") == 0) {
+            is_thumbnail_used = 1;
+        }
+        else if (strcmp(argv[i], "-a") == 0) {
+            is_animated = 1;
+        }
+        else if (strcmp(argv[i], "--watch") == 0) {
+            is_watched = 1;
+        }
+        else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &video_width, &video_height) != 2 || video_width <= 0 || video_height <= 0) {
+                printf("%sPlease give the video's frame size like -v 640x360%s\n", RED, RESET);
+                exit(-1);
             }
-        
         }
-        // new line or flush for last
-        if (y != terminal_height) {
-            ansii_reset();
-            printf("\n");
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            ring_name = argv[++i];
+        }
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            video_format = pixel_format_named(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            batch_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            grid_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            slides_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            server_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            cache_mb = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            grid_columns = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_directory = argv[++i];
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            job_count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--cols") == 0 && i + 1 < argc) {
+            cols = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc) {
+            rows = atoi(argv[++i]);
         }
         else {
-            ansii_reset();
-            fflush(stdout);  
+            path = argv[i];
         }
     }
-    free_image_cells(cells, terminal_width, terminal_height);
+    if (path == NULL && video_width == 0 && ring_name == NULL && batch_path == NULL && grid_path == NULL && slides_path == NULL && serve_path == NULL) {
+        printf("%sPlease provide a single path to and image file you'd like to display%s", RED, RESET);
+        exit(-1);
+    }
+
+    if (serve_path != NULL) {
+        TImageConverter* converter = new_image_converter();
+        converter->is_thumbnail_used = is_thumbnail_used;
+        int result = serve(converter, serve_path, job_count, (size_t)cache_mb * 1024 * 1024);
+        free_image_converter(converter);
+        return result;
+    }
+    if (batch_path != NULL) {
+        TImageConverter* converter = new_image_converter();
+        converter->is_thumbnail_used = is_thumbnail_used;
+        int result = convert_batch(converter, batch_path, job_count, output_directory, cols, rows);
+        free_image_converter(converter);
+        return result;
+    }
+
+    // get window size, --cols and --rows are used instead when they're given (0 rows is as many as the image needs)
+    int terminal_width = cols;
+    int terminal_height = rows;
+    struct winsize w;
+    if (cols <= 0 && ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == -1) {
+        fprintf(stderr, "%sNot writing to a terminal, please give the size to draw at with --cols (and --rows)%s\n", RED, RESET);
+        return 1;
+    }
+    if (cols <= 0) {
+        terminal_width = w.ws_col - 2;
+        terminal_height = rows > 0? rows : w.ws_row - 2;
+        if (info && rows <= 0) {
+            terminal_height -= 5;
+        }
+    }
+
+    if (server_path != NULL) {
+        return request(server_path, path, terminal_width, terminal_height, is_thumbnail_used, info);
+    }
+
+    TImageConverter* converter = new_image_converter();
+    converter->thread_count = thread_count;
+    converter->is_thumbnail_used = is_thumbnail_used;
+    if (slides_path != NULL) {
+        int result = show_slides(converter, slides_path, cols, rows, (size_t)cache_mb * 1024 * 1024, info);
+        free_image_converter(converter);
+        return result;
+    }
+    if (grid_path != NULL) {
+        int result = show_grid(converter, grid_path, grid_columns, job_count, terminal_width, terminal_height, info);
+        free_image_converter(converter);
+        return result;
+    }
+    if (ring_name != NULL) {
+        int result = play_ring(converter, ring_name, terminal_width, terminal_height);
+        free_image_converter(converter);
+        return result;
+    }
+    if (video_width > 0) {
+        int result = play_video(converter, video_width, video_height, video_format, terminal_width, terminal_height);
+        free_image_converter(converter);
+        return result;
+    }
+    if (is_watched) {
+        int result = watch(converter, path, terminal_width, terminal_height, info);
+        free_image_converter(converter);
+        return result;
+    }
+    if (is_animated) {
+        int result = play(converter, path, terminal_width, terminal_height, info);
+        free_image_converter(converter);
+        return result;
+    }
+    TImageLoaded* image = new_loaded_image(converter, path, terminal_width, terminal_height > 0? terminal_height : DISPLAY_HEIGHT_ANY);
+    if (terminal_height == 0) {
+        terminal_height = display_height_for_width(image->pixels.width, image->pixels.height, terminal_width);
+    }
+    size_t frame_bytes = 0;
+    size_t unoptimized_bytes = 0;
+    if (is_streaming) {
+        // print each row as soon as it's converted
+        if (stream_pixels(converter, &image->pixels, terminal_width, terminal_height, STDOUT_FILENO, &frame_bytes) != 0) {
+            perror("write");
+            return 1;
+        }
+    }
+    else {
+        TImagePackedCell* cells = convert_pixels_to_packed_cells(converter, &image->pixels, terminal_width, terminal_height, NULL);
+
+        // print the whole image with one write
+        TImageFrameBuffer* frame = new_frame_buffer();
+        frame_append_cells(frame, cells, terminal_width, terminal_height);
+        if (frame_write(frame, STDOUT_FILENO) != 0) {
+            perror("write");
+            return 1;
+        }
+        frame_bytes = frame->len;
+        unoptimized_bytes = frame->unoptimized_len;
+        free_frame_buffer(frame);
+    }
+    free_image_converter(converter);
     
 
 
     if (info) {
-        int image_width, image_height, channels;
-        uint8_t *image = stbi_load(path, &image_width, &image_height, &channels, 0);
-        free(image);
-
-        printf("image_width %d\n", image_width);
-        printf("image_height %d\n", image_height);
-        printf("channels %d\n", channels);
-
-        FILE *f = fopen(path, "rb");
-        fseek(f, 0, SEEK_END);
-        long size_bytes = ftell(f);
-        fclose(f);
-        double size_mb = (double)size_bytes / (1000.0 * 1000.0);
+        // from the header of the image that was just shown, nothing is loaded again
+        printf("image_width %d\n", image->width);
+        printf("image_height %d\n", image->height);
+        printf("channels %d\n", image->channels);
+        double size_mb = (double)image->file_size / (1000.0 * 1000.0);
         printf("size %.2f MB\n", size_mb);
+        if (is_streaming) {
+            printf("output %zu bytes\n", frame_bytes);
+        }
+        else {
+            printf("output %zu bytes (%zu saved by skipping repeated colors)\n", frame_bytes, unoptimized_bytes - frame_bytes);
+        }
 
     }
+    free_loaded_image(image);
     
     return 0;
 }
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dependencies/TerminalImages.h"
+
+/*
+
+Makes frames in a shared memory ring for trying out `ti -m`, panning across an image.
+
+python3 bear_make.py make_ring_producer -r
+./ti_ring_producer test/red_castle.jpg &
+./ti -m /ti_frames
+
+Options are -n for the ring's name (/ti_frames), -s for the frame size (640x360), -r for
+frames per second (30), -d for how many seconds to run (10, 0 runs until ctrl-c) and -f
+for the pixel format (rgba, also gray, graya, rgb, bgr or bgra). The image is test/red_castle.jpg
+if there isn't one.
+
+*/
+
+
+static volatile sig_atomic_t is_stopped = 0;
+
+static void stop_producing(int signal) {
+    (void)signal;
+    is_stopped = 1;
+}
+
+static double now_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// writes the part of image (RGBA) starting at column offset into frame, the image is scaled to twice the frame's width
+static void draw_frame(
+    uint8_t* frame,
+    int width,
+    int height,
+    int stride,
+    TImagePixelFormat format,
+    uint8_t* image,
+    int image_width,
+    int image_height,
+    int offset
+) {
+    int bytes = pixel_format_bytes(format);
+    const int8_t* layout = PIXEL_LAYOUTS[format];
+    for (int y = 0; y < height; ++y) {
+        uint8_t* row = frame + (size_t)y * stride;
+        int image_y = (int)((int64_t)y * image_height / height);
+        for (int x = 0; x < width; ++x) {
+            int image_x = (int)((int64_t)((x + offset) % (width * 2)) * image_width / (width * 2));
+            uint8_t* pixel = image + ((size_t)image_y * image_width + image_x) * 4;
+            uint8_t* out = row + x * bytes;
+            if (format == PIXEL_FORMAT_GRAY || format == PIXEL_FORMAT_GRAY_ALPHA) {
+                out[0] = (pixel[0] * 77 + pixel[1] * 150 + pixel[2] * 29) >> 8;
+            }
+            else {
+                out[layout[1]] = pixel[0];
+                out[layout[2]] = pixel[1];
+                out[layout[3]] = pixel[2];
+            }
+            if (layout[4] >= 0) out[layout[4]] = pixel[3];
+        }
+    }
+}
+
+
+int main(int argc, char **argv) {
+    char* name = "/ti_frames";
+    char* path = "test/red_castle.jpg";
+    int width = 640;
+    int height = 360;
+    double fps = 30;
+    double seconds = 10;
+    TImagePixelFormat format = PIXEL_FORMAT_RGBA;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            sscanf(argv[++i], "%dx%d", &width, &height);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            fps = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            const char* names[] = {"", "gray", "graya", "rgb", "rgba", "bgr", "bgra"};
+            char* format_name = argv[++i];
+            for (int f = PIXEL_FORMAT_GRAY; f <= PIXEL_FORMAT_BGRA; ++f) {
+                if (strcmp(format_name, names[f]) == 0) format = (TImagePixelFormat)f;
+            }
+        }
+        else {
+            path = argv[i];
+        }
+    }
+    if (fps <= 0) fps = 30;
+
+    int image_width, image_height, channels;
+    uint8_t* image = stbi_load(path, &image_width, &image_height, &channels, 4);
+    if (image == NULL) {
+        fprintf(stderr, "Failed to load image %s: %s\n", path, stbi_failure_reason());
+        return 1;
+    }
+
+    // rows padded to 64 bytes like a capture buffer might be
+    int stride = (width * pixel_format_bytes(format) + 63) / 64 * 64;
+    TImageRing* ring = new_frame_ring(name, width, height, stride, format, 4);
+    if (ring == NULL) {
+        perror("shm");
+        return 1;
+    }
+    signal(SIGINT, stop_producing);
+    signal(SIGTERM, stop_producing);
+
+    double start = now_seconds();
+    long frames = 0;
+    while (!is_stopped && (seconds <= 0 || frames < seconds * fps)) {
+        uint8_t* frame = ring_frame_to_write(ring);
+        draw_frame(frame, width, height, stride, format, image, image_width, image_height, frames * 3);
+        ring_publish_frame(ring);
+        frames++;
+
+        double wait = start + frames / fps - now_seconds();
+        if (wait > 0) {
+            struct timespec sleep = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+            nanosleep(&sleep, NULL);
+        }
+    }
+    fprintf(stderr, "wrote %ld frames of %dx%d to %s at %.1f fps\n", frames, width, height, name, frames / (now_seconds() - start));
+
+    close_frame_ring(ring);
+    free(image);
+    return 0;
+}